@@ -0,0 +1,100 @@
+// Shared helpers for the benchmarks: timing, I/O targets and JSON result lines
+#pragma once
+
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef enum
+{
+    TARGET_FILE,
+    TARGET_PIPE,
+    TARGET_NULL
+} TARGET;
+
+static const char *target_names[] = {"file", "pipe", "devnull"};
+
+typedef struct BENCH_TARGET
+{
+    int fd;
+    pid_t reader; // Child draining the pipe, 0 for other targets
+    char path[256];
+} BENCH_TARGET;
+
+static double bench_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static const char *bench_dir(void)
+{
+    const char *d = getenv("BENCH_DIR");
+    return (d && *d) ? d : "/tmp";
+}
+
+// Open a fresh write target, pipes get a child that reads and discards everything
+static int target_open(BENCH_TARGET *t, TARGET kind)
+{
+    memset(t,0,sizeof(*t));
+    if (kind == TARGET_FILE)
+    {
+        snprintf(t->path,sizeof(t->path),"%s/bench_out_XXXXXX",bench_dir());
+        t->fd = mkstemp(t->path);
+        return (t->fd < 0) ? -1 : 0;
+    }
+
+    if (kind == TARGET_NULL)
+    {
+        t->fd = open("/dev/null",O_WRONLY);
+        return (t->fd < 0) ? -1 : 0;
+    }
+
+    int p[2];
+    if (pipe(p) < 0)
+    {
+        return -1;
+    }
+    t->reader = fork();
+    if (t->reader == 0)
+    {
+        close(p[1]);
+        char buf[65536];
+        while (read(p[0],buf,sizeof(buf)) > 0)
+        {
+        }
+        _exit(0);
+    }
+    close(p[0]);
+    t->fd = p[1];
+    return 0;
+}
+
+// Call once the stream owning t->fd has been closed
+static void target_finish(BENCH_TARGET *t)
+{
+    if (t->reader > 0)
+    {
+        waitpid(t->reader,NULL,0);
+    }
+    if (t->path[0])
+    {
+        unlink(t->path);
+    }
+}
+
+// One result as a JSON object on its own line
+static void report(const char *bench, const char *impl, const char *mode, const char *target, size_t record,
+                   int threads, size_t ops, size_t bytes, double secs)
+{
+    printf("{\"bench\":\"%s\",\"impl\":\"%s\",\"mode\":\"%s\",\"target\":\"%s\",\"record\":%zu,\"threads\":%d,"
+           "\"ops\":%zu,\"ns_per_op\":%.1f,\"mb_per_s\":%.1f}\n",
+           bench,impl,mode,target,record,threads,ops,secs * 1e9 / (ops ? ops : 1),bytes / secs / 1e6);
+    fflush(stdout);
+}
@@ -0,0 +1,329 @@
+// mystdio vs glibc stdio, one JSON line per result (see bench.h)
+#include "../mystdio/mystdio.c"
+#include "bench.h"
+
+#define WRITE_BYTES (8u << 20) // Output per buffered run
+#define SYSCALL_BYTES (256u << 10) // Output per run when every record is a syscall
+#define THREAD_RECORDS 400000 // Records per threaded run, split across the threads
+
+static const char *mode_names[] = {"unbuffered", "line", "full"};
+static const int glibc_modes[] = {_IONBF, _IOLBF, _IOFBF};
+static const size_t records[] = {16, 128, 1024};
+
+typedef enum
+{
+    OP_PUTC,
+    OP_PUTS,
+    OP_PRINTF,
+    OP_PUTS_BYTEWISE // my_puts as it was before the span path: one my_putc per byte
+} OP;
+
+static const char *op_names[] = {"putc", "puts", "printf", "puts"};
+
+// Text of rec bytes including the newline puts appends
+static void make_record(char *s, size_t rec)
+{
+    memset(s,'x',rec - 1);
+    s[rec - 1] = '\0';
+}
+
+static void run_stdio(OP op, BUFFER_MODE mode, TARGET target, size_t rec, int use_glibc)
+{
+    char text[2048];
+    make_record(text,rec);
+    // printf records are "%s %d\n" with the number taking 6 digits
+    char ptext[2048];
+    make_record(ptext,(rec > 9) ? rec - 7 : 2);
+
+    size_t budget = (mode == FULLY_BUFFERED) ? WRITE_BYTES : SYSCALL_BYTES;
+    size_t per = (op == OP_PUTC) ? 1 : rec;
+    size_t ops = budget / per;
+
+    BENCH_TARGET t;
+    if (target_open(&t,target) < 0)
+    {
+        perror("target");
+        return;
+    }
+
+    double start = bench_now();
+    if (use_glibc)
+    {
+        FILE *g = fdopen(t.fd,"w");
+        setvbuf(g,NULL,glibc_modes[mode],BUFFER_SIZE);
+        for (size_t i = 0; i < ops; i++)
+        {
+            switch (op)
+            {
+                case OP_PUTC: fputc((i % 64 == 63) ? '\n' : 'x',g); break;
+                case OP_PRINTF: fprintf(g,"%s %d\n",ptext,(int)(100000 + i % 900000)); break;
+                default: fputs(text,g); fputc('\n',g); break;
+            }
+        }
+        fclose(g);
+    } else
+    {
+        file_t f = my_fdopen(t.fd,WRITE);
+        my_setvbuf(f,NULL,mode,0);
+        for (size_t i = 0; i < ops; i++)
+        {
+            switch (op)
+            {
+                case OP_PUTC: my_putc((i % 64 == 63) ? '\n' : 'x',f); break;
+                case OP_PRINTF: my_printf(f,"%s %d\n",ptext,(int)(100000 + i % 900000)); break;
+                case OP_PUTS_BYTEWISE:
+                    for (const char *p = text; *p; p++)
+                    {
+                        my_putc(*p,f);
+                    }
+                    my_putc('\n',f);
+                    break;
+                default: my_puts(text,f); break;
+            }
+        }
+        my_fclose(f);
+    }
+    double secs = bench_now() - start;
+    target_finish(&t);
+
+    const char *impl = use_glibc ? "glibc" : (op == OP_PUTS_BYTEWISE) ? "mystdio_bytewise" : "mystdio";
+    report(op_names[op],impl,mode_names[mode],target_names[target],(op == OP_PUTC) ? 1 : rec,1,ops,ops * per,secs);
+}
+
+typedef struct THREAD_ARG
+{
+    file_t f;
+    FILE *g;
+    log_t log;
+    size_t records;
+} THREAD_ARG;
+
+static void *printf_worker(void *p)
+{
+    THREAD_ARG *a = p;
+    for (size_t i = 0; i < a->records; i++)
+    {
+        if (a->g)
+        {
+            fprintf(a->g,"worker record %zu status %s\n",i,"ok");
+        } else
+        {
+            my_printf(a->f,"worker record %zu status %s\n",i,"ok");
+        }
+    }
+    return NULL;
+}
+
+static void *log_worker(void *p)
+{
+    THREAD_ARG *a = p;
+    for (size_t i = 0; i < a->records; i++)
+    {
+        my_log_printf(a->log,"worker record %zu status %s\n",i,"ok");
+    }
+    return NULL;
+}
+
+// Many threads writing records to one stream: mystdio lock, glibc lock, or the log ring
+static void run_threads(const char *impl, int threads)
+{
+    BENCH_TARGET t;
+    if (target_open(&t,TARGET_NULL) < 0)
+    {
+        perror("target");
+        return;
+    }
+
+    int glibc = !strcmp(impl,"glibc");
+    int ring = !strcmp(impl,"log_ring");
+    FILE *g = glibc ? fdopen(t.fd,"w") : NULL;
+    file_t f = glibc ? NULL : my_fdopen(t.fd,WRITE);
+    log_t log = ring ? my_log_open(f) : NULL;
+
+    pthread_t tid[64];
+    THREAD_ARG arg = {f, g, log, THREAD_RECORDS / threads};
+    double start = bench_now();
+    for (int i = 0; i < threads; i++)
+    {
+        pthread_create(&tid[i],NULL,ring ? log_worker : printf_worker,&arg);
+    }
+    for (int i = 0; i < threads; i++)
+    {
+        pthread_join(tid[i],NULL);
+    }
+
+    size_t ops = arg.records * threads;
+    if (ring)
+    {
+        ops -= my_log_dropped(log);
+        my_log_close(log);
+    }
+    if (glibc)
+    {
+        fclose(g);
+    } else
+    {
+        my_fclose(f);
+    }
+    double secs = bench_now() - start;
+    target_finish(&t);
+
+    report(ring ? "log" : "printf_shared",impl,"full","devnull",32,threads,ops,ops * 32,secs);
+}
+
+// glibc_fmt is the closest glibc format, %.17g stands in for the shortest round-trip %~g
+static void run_doubles(const char *fmt, const char *glibc_fmt)
+{
+    enum { N = 500000 };
+    static double vals[N];
+    unsigned long long x = 88172645463325252ULL;
+    for (int i = 0; i < N; i++)
+    {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        vals[i] = (double)(x >> 11) / (double)(1ULL << 53) * pow(10,(int)(x % 20) - 10);
+    }
+
+    for (int use_glibc = 0; use_glibc < 2; use_glibc++)
+    {
+        BENCH_TARGET t;
+        target_open(&t,TARGET_NULL);
+        double start = bench_now();
+        if (use_glibc)
+        {
+            FILE *g = fdopen(t.fd,"w");
+            for (int i = 0; i < N; i++)
+            {
+                fprintf(g,glibc_fmt,vals[i]);
+            }
+            fclose(g);
+        } else
+        {
+            file_t f = my_fdopen(t.fd,WRITE);
+            for (int i = 0; i < N; i++)
+            {
+                my_printf(f,fmt,vals[i]);
+            }
+            my_fclose(f);
+        }
+        double secs = bench_now() - start;
+        target_finish(&t);
+        report(fmt,use_glibc ? "glibc" : "mystdio","full","devnull",0,1,N,0,secs);
+    }
+}
+
+// Large payloads: one my_fwrite (writev with the pending bytes) vs feeding it through the buffer copy path
+static void run_large_writes(void)
+{
+    const size_t total = 64u << 20;
+    char *payload = malloc(16u << 20);
+    memset(payload,'p',16u << 20);
+
+    for (size_t len = 4096; len <= (16u << 20); len *= 4)
+    {
+        for (int copy = 0; copy < 2; copy++)
+        {
+            BENCH_TARGET t;
+            target_open(&t,TARGET_FILE);
+            file_t f = my_fdopen(t.fd,WRITE);
+            my_setvbuf(f,NULL,FULLY_BUFFERED,0);
+            size_t ops = (total / len) ? total / len : 1;
+
+            double start = bench_now();
+            for (size_t i = 0; i < ops; i++)
+            {
+                my_putc('h',f); // A pending header byte, so the writev carries two iovecs
+                if (copy)
+                {
+                    // Pieces smaller than the buffer always take the memcpy + flush path
+                    for (size_t off = 0; off < len; off += BUFFER_SIZE / 2)
+                    {
+                        size_t n = (len - off < BUFFER_SIZE / 2) ? len - off : BUFFER_SIZE / 2;
+                        my_fwrite(payload + off,1,n,f);
+                    }
+                } else
+                {
+                    my_fwrite(payload,1,len,f);
+                }
+            }
+            my_fclose(f);
+            double secs = bench_now() - start;
+            target_finish(&t);
+            report("large_write",copy ? "copy" : "writev","full","file",len,1,ops,ops * (len + 1),secs);
+        }
+    }
+    free(payload);
+}
+
+// Open/close churn: pooled stream blocks vs glibc FILE allocation
+static void run_churn(void)
+{
+    enum { N = 200000 };
+    for (int use_glibc = 0; use_glibc < 2; use_glibc++)
+    {
+        double start = bench_now();
+        for (int i = 0; i < N; i++)
+        {
+            int fd = open("/dev/null",O_WRONLY);
+            if (use_glibc)
+            {
+                FILE *g = fdopen(fd,"w");
+                fputc('x',g);
+                fclose(g);
+            } else
+            {
+                file_t f = my_fdopen(fd,WRITE);
+                my_putc('x',f);
+                my_fclose(f);
+            }
+        }
+        double secs = bench_now() - start;
+        report("open_close",use_glibc ? "glibc" : "mystdio","full","devnull",1,1,N,N,secs);
+    }
+}
+
+int main(void)
+{
+    signal(SIGPIPE,SIG_IGN);
+
+    for (int mode = UNBUFFERED; mode <= FULLY_BUFFERED; mode++)
+    {
+        for (int target = TARGET_FILE; target <= TARGET_NULL; target++)
+        {
+            for (int use_glibc = 0; use_glibc < 2; use_glibc++)
+            {
+                run_stdio(OP_PUTC,(BUFFER_MODE)mode,(TARGET)target,1,use_glibc);
+                for (size_t r = 0; r < sizeof(records) / sizeof(records[0]); r++)
+                {
+                    run_stdio(OP_PUTS,(BUFFER_MODE)mode,(TARGET)target,records[r],use_glibc);
+                    run_stdio(OP_PRINTF,(BUFFER_MODE)mode,(TARGET)target,records[r],use_glibc);
+                }
+            }
+            if (mode == FULLY_BUFFERED)
+            {
+                for (size_t r = 0; r < sizeof(records) / sizeof(records[0]); r++)
+                {
+                    run_stdio(OP_PUTS_BYTEWISE,FULLY_BUFFERED,(TARGET)target,records[r],0);
+                }
+            }
+        }
+    }
+
+    static const int thread_counts[] = {1, 4, 16};
+    for (size_t i = 0; i < sizeof(thread_counts) / sizeof(thread_counts[0]); i++)
+    {
+        run_threads("mystdio",thread_counts[i]);
+        run_threads("glibc",thread_counts[i]);
+        run_threads("log_ring",thread_counts[i]);
+    }
+
+    run_doubles("%g","%g");
+    run_doubles("%~g","%.17g");
+    run_doubles("%.17g","%.17g");
+    run_doubles("%.3f","%.3f");
+
+    run_large_writes();
+    run_churn();
+    return 0;
+}
@@ -0,0 +1,330 @@
+// rio vs glibc fread/fwrite and raw read/write, one JSON line per result (see bench.h)
+#include "../rio/rio.c"
+#include "bench.h"
+
+#define READ_BYTES (64u << 20) // Input per read run
+#define WRITE_BYTES (16u << 20) // Output per write run
+#define PREAD_OPS 400000 // Positional reads per threaded run, split across the threads
+
+static const size_t records[] = {16, 256, 4096, 65536};
+
+// A source of READ_BYTES: a file in BENCH_DIR, or a pipe fed by a child
+typedef struct SOURCE
+{
+    char path[256];
+    pid_t writer;
+} SOURCE;
+
+static char file_src[256];
+
+static void make_file_source(void)
+{
+    snprintf(file_src,sizeof(file_src),"%s/bench_in_XXXXXX",bench_dir());
+    int fd = mkstemp(file_src);
+    char *chunk = malloc(1u << 20);
+    memset(chunk,'r',1u << 20);
+    for (size_t i = 0; i < READ_BYTES; i += 1u << 20)
+    {
+        if (write(fd,chunk,1u << 20) != 1u << 20)
+        {
+            perror("write");
+            exit(1);
+        }
+    }
+    free(chunk);
+    close(fd);
+}
+
+static void source_open(SOURCE *s, TARGET kind)
+{
+    memset(s,0,sizeof(*s));
+    if (kind == TARGET_FILE)
+    {
+        snprintf(s->path,sizeof(s->path),"%s",file_src);
+        return;
+    }
+
+    int p[2];
+    if (pipe(p) < 0)
+    {
+        perror("pipe");
+        exit(1);
+    }
+    s->writer = fork();
+    if (s->writer == 0)
+    {
+        close(p[0]);
+        char buf[65536];
+        memset(buf,'r',sizeof(buf));
+        for (size_t i = 0; i < READ_BYTES; i += sizeof(buf))
+        {
+            if (write(p[1],buf,sizeof(buf)) < 0)
+            {
+                break;
+            }
+        }
+        _exit(0);
+    }
+    close(p[1]);
+    // Every implementation opens the source by path, /dev/fd hands them the read end
+    snprintf(s->path,sizeof(s->path),"/dev/fd/%d",p[0]);
+}
+
+static void source_close(SOURCE *s)
+{
+    if (s->writer > 0)
+    {
+        int fd;
+        sscanf(s->path,"/dev/fd/%d",&fd);
+        close(fd);
+        waitpid(s->writer,NULL,0);
+    }
+}
+
+// rio_read, rio_readn, fread and read() pulling the whole source in records of rec bytes
+static void run_read(const char *impl, TARGET kind, size_t rec)
+{
+    static char buf[65536];
+    SOURCE s;
+    source_open(&s,kind);
+
+    size_t total = 0, ops = 0;
+    double start = bench_now();
+    if (!strcmp(impl,"rio_read") || !strcmp(impl,"rio_readn"))
+    {
+        int readn = !strcmp(impl,"rio_readn");
+        rio_t r = rio_open(s.path,O_RDONLY,0);
+        ssize_t n;
+        while ((n = readn ? rio_readn(r,buf,rec) : rio_read(r,buf,rec)) > 0)
+        {
+            total += n;
+            ops++;
+        }
+        rio_close(r);
+    } else if (!strcmp(impl,"fread"))
+    {
+        FILE *g = fopen(s.path,"r");
+        size_t n;
+        while ((n = fread(buf,1,rec,g)) > 0)
+        {
+            total += n;
+            ops++;
+        }
+        fclose(g);
+    } else
+    {
+        int fd = open(s.path,O_RDONLY);
+        ssize_t n;
+        while ((n = read(fd,buf,rec)) > 0)
+        {
+            total += n;
+            ops++;
+        }
+        close(fd);
+    }
+    double secs = bench_now() - start;
+    source_close(&s);
+    report("read",impl,"-",target_names[kind],rec,1,ops,total,secs);
+}
+
+// rio_writen, rio_writeb, fwrite and write() sending WRITE_BYTES in records of rec bytes
+static void run_write(const char *impl, TARGET kind, size_t rec)
+{
+    static char buf[65536];
+    memset(buf,'w',sizeof(buf));
+    // Unbuffered records of 16 bytes are one syscall each, keep those runs short
+    size_t budget = (rec < 4096 && (!strcmp(impl,"rio_writen") || !strcmp(impl,"write"))) ? WRITE_BYTES / 16 : WRITE_BYTES;
+    size_t ops = budget / rec;
+
+    BENCH_TARGET t;
+    if (target_open(&t,kind) < 0)
+    {
+        perror("target");
+        return;
+    }
+    char path[64];
+    snprintf(path,sizeof(path),"/dev/fd/%d",t.fd);
+
+    double start = bench_now();
+    if (!strcmp(impl,"rio_writen") || !strcmp(impl,"rio_writeb"))
+    {
+        int buffered = !strcmp(impl,"rio_writeb");
+        rio_t r = rio_open(path,O_WRONLY,0);
+        for (size_t i = 0; i < ops; i++)
+        {
+            if (buffered)
+            {
+                rio_writeb(r,buf,rec);
+            } else
+            {
+                rio_writen(r,buf,rec);
+            }
+        }
+        rio_close(r);
+    } else if (!strcmp(impl,"fwrite"))
+    {
+        FILE *g = fopen(path,"w");
+        for (size_t i = 0; i < ops; i++)
+        {
+            fwrite(buf,1,rec,g);
+        }
+        fclose(g);
+    } else
+    {
+        for (size_t i = 0; i < ops; i++)
+        {
+            if (write(t.fd,buf,rec) < 0)
+            {
+                break;
+            }
+        }
+    }
+    close(t.fd);
+    double secs = bench_now() - start;
+    target_finish(&t);
+    report("write",impl,"-",target_names[kind],rec,1,ops,ops * rec,secs);
+}
+
+typedef struct PREAD_ARG
+{
+    rio_t r;
+    size_t ops;
+    unsigned seed;
+} PREAD_ARG;
+
+static void *pread_worker(void *p)
+{
+    PREAD_ARG *a = p;
+    char buf[512];
+    // Offsets drawn from a 1 MiB hot set so the page cache has something to hit
+    for (size_t i = 0; i < a->ops; i++)
+    {
+        a->seed = a->seed * 1103515245 + 12345;
+        rio_preadn(a->r,buf,sizeof(buf),(off_t)(a->seed % ((1u << 20) - sizeof(buf))));
+    }
+    return NULL;
+}
+
+static void run_pread(int threads, int pcache)
+{
+    rio_t r = rio_open(file_src,O_RDONLY | RIO_NOMMAP,0);
+    if (pcache)
+    {
+        rio_enable_pcache(r,512);
+    }
+
+    pthread_t tid[64];
+    PREAD_ARG args[64];
+    double start = bench_now();
+    for (int i = 0; i < threads; i++)
+    {
+        args[i] = (PREAD_ARG){r, PREAD_OPS / threads, (unsigned)i + 1};
+        pthread_create(&tid[i],NULL,pread_worker,&args[i]);
+    }
+    for (int i = 0; i < threads; i++)
+    {
+        pthread_join(tid[i],NULL);
+    }
+    double secs = bench_now() - start;
+    rio_close(r);
+
+    size_t ops = (size_t)(PREAD_OPS / threads) * threads;
+    report("preadn",pcache ? "rio_pcache" : "rio","-","file",512,threads,ops,ops * 512,secs);
+}
+
+// rio_copy (copy_file_range) vs a rio_read + rio_writen loop, file to file
+// An untimed pass warms the page cache, then the two run in ABBA order so neither always goes first
+static void run_copy(size_t mb)
+{
+    char in[256], out[256];
+    snprintf(in,sizeof(in),"%s/bench_copy_in_XXXXXX",bench_dir());
+    snprintf(out,sizeof(out),"%s/bench_copy_out_XXXXXX",bench_dir());
+    int fd = mkstemp(in);
+    int ofd = mkstemp(out);
+    close(ofd);
+
+    char *chunk = malloc(1u << 20);
+    memset(chunk,'c',1u << 20);
+    for (size_t i = 0; i < mb; i++)
+    {
+        if (write(fd,chunk,1u << 20) != 1u << 20)
+        {
+            perror("write");
+            exit(1);
+        }
+    }
+    close(fd);
+
+    size_t total = mb << 20;
+    static const int order[] = {-1, 0, 1, 1, 0}; // -1: warm-up, 0: rio_copy, 1: rio_read_writen
+    for (size_t i = 0; i < sizeof(order) / sizeof(order[0]); i++)
+    {
+        int loop = order[i];
+        rio_t src = rio_open(in,O_RDONLY | RIO_NOMMAP,0);
+        rio_t dst = rio_open(out,O_WRONLY | O_TRUNC,0);
+        size_t ops = 0;
+        double start = bench_now();
+        if (loop)
+        {
+            ssize_t n;
+            while ((n = rio_read(src,chunk,1u << 20)) > 0)
+            {
+                rio_writen(dst,chunk,n);
+                ops++;
+            }
+        } else
+        {
+            rio_copy(dst,src,total);
+            ops = 1;
+        }
+        rio_close(dst);
+        double secs = bench_now() - start;
+        rio_close(src);
+        if (loop >= 0)
+        {
+            report("copy",loop ? "rio_read_writen" : "rio_copy","-","file",total,1,ops,total,secs);
+        }
+    }
+    free(chunk);
+    unlink(in);
+    unlink(out);
+}
+
+int main(void)
+{
+    signal(SIGPIPE,SIG_IGN);
+    make_file_source();
+
+    static const char *readers[] = {"rio_read", "rio_readn", "fread", "read"};
+    static const char *writers[] = {"rio_writen", "rio_writeb", "fwrite", "write"};
+    for (size_t r = 0; r < sizeof(records) / sizeof(records[0]); r++)
+    {
+        for (int kind = TARGET_FILE; kind <= TARGET_PIPE; kind++)
+        {
+            for (int i = 0; i < 4; i++)
+            {
+                run_read(readers[i],(TARGET)kind,records[r]);
+            }
+        }
+        for (int kind = TARGET_FILE; kind <= TARGET_NULL; kind++)
+        {
+            for (int i = 0; i < 4; i++)
+            {
+                run_write(writers[i],(TARGET)kind,records[r]);
+            }
+        }
+    }
+
+    static const int thread_counts[] = {1, 4, 16};
+    for (size_t i = 0; i < sizeof(thread_counts) / sizeof(thread_counts[0]); i++)
+    {
+        run_pread(thread_counts[i],0);
+        run_pread(thread_counts[i],1);
+    }
+
+    const char *mb = getenv("BENCH_COPY_MB");
+    run_copy((mb && *mb) ? strtoul(mb,NULL,10) : 256);
+
+    unlink(file_src);
+    return 0;
+}
@@ -0,0 +1,346 @@
+// Compile-time parsed format strings on top of mystdio (C++20)
+// my_format<"id=%d name=%s">(f, id, name) splits the format into literal spans and typed
+// argument writers at compile time, mismatched argument types fail to compile
+// Supports %d %i %u %x %ld %lu %lx %lld %llu %llx %zu %zx %s %c %p %% (no flags/width/precision,
+// use my_printf for those and for floating point)
+#pragma once
+
+#include <cstddef>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+extern "C"
+{
+typedef struct MY_FILE MY_FILE;
+typedef MY_FILE* file_t;
+
+extern const char my_digit_pairs[201];
+
+size_t my_fwrite_unlocked(const void *ptr, size_t size, size_t nmemb, file_t f);
+void my_flockfile(file_t f);
+void my_funlockfile(file_t f);
+}
+
+namespace mystdio
+{
+
+template <std::size_t N>
+struct fixed_string
+{
+    char data[N];
+
+    constexpr fixed_string(const char (&s)[N])
+    {
+        for (std::size_t i = 0; i < N; i++)
+        {
+            data[i] = s[i];
+        }
+    }
+
+    constexpr std::size_t size() const { return N - 1; }
+};
+
+enum class conv
+{
+    literal,
+    sint,
+    uint,
+    hex,
+    str,
+    chr,
+    ptr
+};
+
+enum class width
+{
+    normal,
+    l,
+    ll,
+    z
+};
+
+struct segment
+{
+    conv kind = conv::literal;
+    width len = width::normal;
+    std::size_t begin = 0; // Literal span in the format string
+    std::size_t size = 0;
+    std::size_t arg = 0;   // Argument index for conversions
+};
+
+struct parse_result
+{
+    std::size_t segments = 0;
+    std::size_t args = 0;
+    bool bad = false;
+};
+
+// Walk the format once, counting segments or filling out when it is given
+template <std::size_t N>
+constexpr parse_result parse(const fixed_string<N> &fmt, segment *out)
+{
+    parse_result r;
+    std::size_t i = 0;
+    const std::size_t n = fmt.size();
+
+    auto emit = [&](segment s)
+    {
+        if (out)
+        {
+            out[r.segments] = s;
+        }
+        r.segments++;
+    };
+
+    while (i < n)
+    {
+        if (fmt.data[i] != '%')
+        {
+            std::size_t start = i;
+            while (i < n && fmt.data[i] != '%')
+            {
+                i++;
+            }
+            emit(segment{conv::literal, width::normal, start, i - start, 0});
+            continue;
+        }
+
+        i++;
+        if (i >= n)
+        {
+            r.bad = true;
+            break;
+        }
+
+        if (fmt.data[i] == '%')
+        {
+            emit(segment{conv::literal, width::normal, i, 1, 0});
+            i++;
+            continue;
+        }
+
+        width len = width::normal;
+        if (fmt.data[i] == 'l')
+        {
+            i++;
+            len = width::l;
+            if (i < n && fmt.data[i] == 'l')
+            {
+                i++;
+                len = width::ll;
+            }
+        } else if (fmt.data[i] == 'z')
+        {
+            i++;
+            len = width::z;
+        }
+
+        if (i >= n)
+        {
+            r.bad = true;
+            break;
+        }
+
+        conv kind;
+        switch (fmt.data[i])
+        {
+            case 'd':
+            case 'i': kind = conv::sint; break;
+            case 'u': kind = conv::uint; break;
+            case 'x': kind = conv::hex; break;
+            case 's': kind = conv::str; break;
+            case 'c': kind = conv::chr; break;
+            case 'p': kind = conv::ptr; break;
+            default: kind = conv::literal; r.bad = true; break;
+        }
+
+        if ((kind == conv::str || kind == conv::chr || kind == conv::ptr) && len != width::normal)
+        {
+            r.bad = true;
+        }
+
+        emit(segment{kind, len, 0, 0, r.args++});
+        i++;
+    }
+
+    return r;
+}
+
+template <fixed_string Fmt>
+struct parsed
+{
+    static constexpr parse_result info = parse(Fmt, nullptr);
+
+    static constexpr auto segments = []
+    {
+        struct table { segment s[info.segments ? info.segments : 1]; } t{};
+        parse(Fmt, t.s);
+        return t;
+    }();
+};
+
+// Exact argument type each conversion accepts, no implicit promotions
+template <conv C, width W>
+struct arg_type;
+
+template <> struct arg_type<conv::sint, width::normal> { using type = int; };
+template <> struct arg_type<conv::sint, width::l> { using type = long; };
+template <> struct arg_type<conv::sint, width::ll> { using type = long long; };
+template <> struct arg_type<conv::sint, width::z> { using type = std::make_signed_t<std::size_t>; };
+template <> struct arg_type<conv::uint, width::normal> { using type = unsigned; };
+template <> struct arg_type<conv::uint, width::l> { using type = unsigned long; };
+template <> struct arg_type<conv::uint, width::ll> { using type = unsigned long long; };
+template <> struct arg_type<conv::uint, width::z> { using type = std::size_t; };
+template <width W> struct arg_type<conv::hex, W> : arg_type<conv::uint, W> {};
+template <> struct arg_type<conv::chr, width::normal> { using type = char; };
+
+template <conv C, width W, typename T>
+constexpr bool accepts()
+{
+    using U = std::remove_cvref_t<T>;
+    if constexpr (C == conv::str)
+    {
+        return std::is_same_v<std::decay_t<U>, const char *> || std::is_same_v<std::decay_t<U>, char *>;
+    } else if constexpr (C == conv::ptr)
+    {
+        return std::is_pointer_v<std::decay_t<U>>;
+    } else
+    {
+        return std::is_same_v<U, typename arg_type<C, W>::type>;
+    }
+}
+
+// Write v backwards ending at end, returns the first digit
+inline char *write_dec(char *end, unsigned long long v)
+{
+    while (v >= 100)
+    {
+        unsigned idx = (unsigned)(v % 100) * 2;
+        v /= 100;
+        *--end = my_digit_pairs[idx + 1];
+        *--end = my_digit_pairs[idx];
+    }
+    if (v >= 10)
+    {
+        *--end = my_digit_pairs[v * 2 + 1];
+        *--end = my_digit_pairs[v * 2];
+    } else
+    {
+        *--end = (char)('0' + v);
+    }
+    return end;
+}
+
+inline char *write_hex(char *end, unsigned long long v)
+{
+    do
+    {
+        *--end = "0123456789abcdef"[v & 0xf];
+        v >>= 4;
+    } while (v);
+    return end;
+}
+
+inline int write_span(file_t f, const char *p, std::size_t n)
+{
+    return (my_fwrite_unlocked(p, 1, n, f) == n) ? (int)n : -1;
+}
+
+template <conv C, typename T>
+int write_arg(file_t f, const T &v)
+{
+    char buf[24];
+    char *end = buf + sizeof(buf);
+    char *start;
+
+    if constexpr (C == conv::str)
+    {
+        const char *s = v;
+        if (!s)
+        {
+            s = "NULL";
+        }
+        std::size_t n = 0;
+        while (s[n])
+        {
+            n++;
+        }
+        return write_span(f, s, n);
+    } else if constexpr (C == conv::chr)
+    {
+        return write_span(f, &v, 1);
+    } else if constexpr (C == conv::ptr)
+    {
+        start = write_hex(end, (unsigned long long)(std::size_t)v);
+        *--start = 'x';
+        *--start = '0';
+    } else if constexpr (C == conv::hex)
+    {
+        start = write_hex(end, (unsigned long long)v);
+    } else if constexpr (C == conv::uint)
+    {
+        start = write_dec(end, (unsigned long long)v);
+    } else
+    {
+        // Negate in unsigned arithmetic so the minimum value is safe
+        unsigned long long mag = (v < 0) ? 0ULL - (unsigned long long)v : (unsigned long long)v;
+        start = write_dec(end, mag);
+        if (v < 0)
+        {
+            *--start = '-';
+        }
+    }
+
+    return write_span(f, start, end - start);
+}
+
+template <fixed_string Fmt, std::size_t I, typename Tuple>
+int write_segment(file_t f, const Tuple &args)
+{
+    constexpr segment s = parsed<Fmt>::segments.s[I];
+    if constexpr (s.kind == conv::literal)
+    {
+        return write_span(f, Fmt.data + s.begin, s.size);
+    } else
+    {
+        using T = std::tuple_element_t<s.arg, Tuple>;
+        static_assert(accepts<s.kind, s.len, T>(), "my_format: argument type does not match its conversion");
+        return write_arg<s.kind>(f, std::get<s.arg>(args));
+    }
+}
+
+template <fixed_string Fmt, typename Tuple, std::size_t... I>
+int write_segments([[maybe_unused]] file_t f, [[maybe_unused]] const Tuple &args, std::index_sequence<I...>)
+{
+    int count = 0;
+    bool ok = ((count >= 0 && [&]
+    {
+        int n = write_segment<Fmt, I>(f, args);
+        count = (n < 0) ? -1 : count + n;
+        return n >= 0;
+    }()) && ...);
+    return ok ? count : -1;
+}
+
+} // namespace mystdio
+
+// Returns bytes written or -1, the stream lock is held once for the whole record
+template <mystdio::fixed_string Fmt, typename... Args>
+int my_format(file_t f, const Args &...args)
+{
+    using P = mystdio::parsed<Fmt>;
+    static_assert(!P::info.bad, "my_format: unsupported or malformed directive in format string");
+    static_assert(P::info.args == sizeof...(Args), "my_format: argument count does not match format string");
+
+    if (!f)
+    {
+        return -1;
+    }
+
+    my_flockfile(f);
+    int res = mystdio::write_segments<Fmt>(f, std::tuple<const Args &...>(args...),
+                                      std::make_index_sequence<P::info.segments>{});
+    my_funlockfile(f);
+    return res;
+}
@@ -1,12 +1,44 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // memrchr
+#endif
 #include <fcntl.h>
+#include <math.h>
+#include <pthread.h>
+#include <sched.h>
 #include <errno.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
-#define BUFFER_SIZE 4096 // Size of read/write buffer
-typedef MY_FILE* file_t;
+// io_uring backend for the write-behind flusher, opt in with -DMYSTDIO_IO_URING
+// Off by default: make bench measured the plain write() thread faster on small fast files
+#if defined(MYSTDIO_IO_URING) && defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#else
+#undef MYSTDIO_IO_URING
+#endif
+#else
+#undef MYSTDIO_IO_URING
+#endif
+
+#define BUFFER_SIZE 4096 // Default size of read/write buffer, see my_setvbuf
+#define LOG_SLOT_SIZE 256 // Max bytes per record in the log ring
+#define LOG_RING_SLOTS 1024 // Must be a power of two
+#define REGISTRY_CHUNK 256 // Streams per registry chunk
+#define REGISTRY_CHUNKS 256 // Up to 65536 registered streams
+#define STREAM_POOL_MAX 1024 // Closed streams kept for reuse
+#define URING_ENTRIES 256 // Submission queue depth of the flusher ring
+#define STATS_BUCKETS 24 // Flush latency buckets: < 1us, then one per power of two up to ~4s
 
 typedef enum 
 {
@@ -21,19 +53,87 @@ typedef enum
     WRITE
 } IO_MODE;
 
+typedef enum
+{
+    FD_BACKED,
+    MEM_FIXED,   // my_fmemopen, buffer is the caller's memory
+    MEM_GROWABLE // my_open_memstream, buffer grows geometrically
+} BACKEND;
+
+// Why a buffer was written out
+typedef enum
+{
+    FLUSH_FULL,
+    FLUSH_NEWLINE,
+    FLUSH_EXPLICIT, // my_fflush, my_setvbuf, log drains and exit-time flushes
+    FLUSH_CLOSE,
+    FLUSH_CAUSES
+} FLUSH_CAUSE;
+
+// Per-stream I/O counters, only maintained when built with -DMYSTDIO_STATS
+typedef struct MY_STATS
+{
+    unsigned long long bytes_written;
+    unsigned long long bytes_read;
+    unsigned long long write_calls; // write/writev syscalls or io_uring writes
+    unsigned long long read_calls;
+    unsigned long long short_writes;
+    unsigned long long eintr_retries;
+    unsigned long long flushes[FLUSH_CAUSES]; // Indexed by FLUSH_CAUSE
+    unsigned long long flushed_bytes; // Divide by the flush count for the average fill at flush time
+    unsigned long long flush_latency[STATS_BUCKETS]; // Bucket 0: < 1us, bucket i: [2^(i-1), 2^i) us
+} MY_STATS;
+
 typedef struct MY_FILE
 {
     int fd;
     char *buffer;
+    size_t buf_size; // Capacity of buffer
+    int owns_buf; // Buffer was malloc'd by us, not supplied through my_setvbuf
     size_t bytes_in_buf;
+    size_t read_pos; // Next unread byte in buffer (READ streams)
+    char pushback; // my_ungetc byte of a fmemopen stream, read from here since the caller's buffer may be read-only
+    char *pushed_buf; // Rest of the caller's buffer while buffer points at pushback, NULL otherwise
+    size_t pushed_len;
 
     BUFFER_MODE bmode;
     IO_MODE imode;
+    BACKEND backend;
+    char **mem_ptr; // my_open_memstream result locations
+    size_t *mem_size;
+    size_t reg_slot; // Registry slot + 1, 0 when not registered
+    struct MY_FILE *pool_next; // Free list link while parked in the stream pool
+
+    int async; // Full buffers are handed to the background flusher, see my_set_async
+    char *spare; // Buffer to swap in while the other one is being written
+    char *async_alloc; // Second buffer allocated by my_set_async
+    const char *inflight_buf; // Buffer queued for or being written by the flusher
+    size_t inflight_len;
+    size_t inflight_done; // Bytes of inflight_buf already written (io_uring short writes)
+    int inflight;
+    int async_err; // errno of a failed background write, reported on the next flush
+    struct MY_FILE *async_next;
 
     int err;
     int eof;
+
+#ifdef MYSTDIO_STATS
+    MY_STATS stats; // Also updated by the flusher thread, hence the atomic adds
+#endif
+
+    pthread_mutex_t lock; // Recursive, so my_flockfile can wrap other calls
 } MY_FILE;
 
+typedef MY_FILE* file_t;
+
+// Streams are carved out of one cache-line aligned block with their default buffer right behind them
+typedef struct STREAM_BLOCK
+{
+    _Alignas(64) MY_FILE file;
+    _Alignas(64) char buffer[BUFFER_SIZE];
+} STREAM_BLOCK;
+
+
 int mode_to_flags(const char *mode, IO_MODE *m)
 {
     if (strcmp(mode, "r") == 0) {
@@ -55,9 +155,174 @@ int mode_to_flags(const char *mode, IO_MODE *m)
 }
 
 
+// Closed streams are recycled through a free list so churn skips malloc/free and lock setup
+static file_t pool_free;
+static size_t pool_count;
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Take a stream from the pool or allocate a fresh block, buffering is left to the caller
+static file_t new_stream(int fdes, IO_MODE mode)
+{
+    pthread_mutex_lock(&pool_lock);
+    file_t f = pool_free;
+    if (f)
+    {
+        pool_free = f->pool_next;
+        pool_count--;
+    }
+    pthread_mutex_unlock(&pool_lock);
+
+    if (!f)
+    {
+        STREAM_BLOCK *b = aligned_alloc(64,sizeof(STREAM_BLOCK));
+        if (!b)
+        {
+            return NULL;
+        }
+        f = &b->file;
+
+        // The lock survives recycling, it is only set up for fresh blocks
+        pthread_mutexattr_t attr;
+        pthread_mutexattr_init(&attr);
+        pthread_mutexattr_settype(&attr,PTHREAD_MUTEX_RECURSIVE);
+        pthread_mutex_init(&f->lock,&attr);
+        pthread_mutexattr_destroy(&attr);
+    }
+
+    // Reset field by field instead of clearing the whole block
+    f->fd = fdes;
+    f->buffer = NULL;
+    f->buf_size = 0;
+    f->owns_buf = 0;
+    f->bytes_in_buf = 0;
+    f->read_pos = 0;
+    f->pushback = 0;
+    f->pushed_buf = NULL;
+    f->pushed_len = 0;
+    f->bmode = FULLY_BUFFERED;
+    f->imode = mode;
+    f->backend = FD_BACKED;
+    f->mem_ptr = NULL;
+    f->mem_size = NULL;
+    f->reg_slot = 0;
+    f->pool_next = NULL;
+    f->async = 0;
+    f->spare = NULL;
+    f->async_alloc = NULL;
+    f->inflight_buf = NULL;
+    f->inflight_len = 0;
+    f->inflight_done = 0;
+    f->inflight = 0;
+    f->async_err = 0;
+    f->async_next = NULL;
+    f->err = 0;
+    f->eof = 0;
+#ifdef MYSTDIO_STATS
+    memset(&f->stats,0,sizeof(f->stats));
+#endif
+
+    return f;
+}
+
+// Buffer that lives right behind the stream in its block
+static char *inline_buffer(file_t f)
+{
+    return ((STREAM_BLOCK *)f)->buffer;
+}
+
+// Park the stream in the pool, or free it once the pool is full
+static void release_stream(file_t f)
+{
+    if (f->owns_buf)
+    {
+        free(f->buffer);
+    }
+
+    pthread_mutex_lock(&pool_lock);
+    if (pool_count < STREAM_POOL_MAX)
+    {
+        f->pool_next = pool_free;
+        pool_free = f;
+        pool_count++;
+        f = NULL;
+    }
+    pthread_mutex_unlock(&pool_lock);
+
+    if (f)
+    {
+        pthread_mutex_destroy(&f->lock);
+        free(f);
+    }
+}
+
+// Registry of every stream from my_fdopen/my_fopen so they can be flushed at exit or from a
+// signal handler. Chunks are allocated once and never freed, so the signal path can walk them
+// without locks. Only open/close take registry_lock, my_putc never touches the registry.
+static _Atomic(file_t) *_Atomic registry[REGISTRY_CHUNKS];
+static pthread_mutex_t registry_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t registry_once = PTHREAD_ONCE_INIT;
+static size_t registry_hint; // Lowest slot that may be free
+
+void my_flush_all(void);
+
+static void registry_init(void)
+{
+    atexit(my_flush_all);
+}
+
+// Best effort, a stream that does not fit (registry full or out of memory) is simply not tracked
+static void register_stream(file_t f)
+{
+    pthread_once(&registry_once,registry_init);
+    pthread_mutex_lock(&registry_lock);
+
+    for (size_t slot = registry_hint; slot < REGISTRY_CHUNK * REGISTRY_CHUNKS; slot++)
+    {
+        size_t c = slot / REGISTRY_CHUNK;
+        _Atomic(file_t) *chunk = atomic_load(&registry[c]);
+        if (!chunk)
+        {
+            chunk = calloc(REGISTRY_CHUNK,sizeof(*chunk));
+            if (!chunk)
+            {
+                break;
+            }
+            atomic_store(&registry[c],chunk);
+        }
+
+        if (!atomic_load_explicit(&chunk[slot % REGISTRY_CHUNK],memory_order_relaxed))
+        {
+            atomic_store_explicit(&chunk[slot % REGISTRY_CHUNK],f,memory_order_release);
+            f->reg_slot = slot + 1;
+            registry_hint = slot + 1;
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&registry_lock);
+}
+
+static void unregister_stream(file_t f)
+{
+    if (!f->reg_slot)
+    {
+        return;
+    }
+
+    size_t slot = f->reg_slot - 1;
+    pthread_mutex_lock(&registry_lock);
+    atomic_store_explicit(&registry[slot / REGISTRY_CHUNK][slot % REGISTRY_CHUNK],NULL,memory_order_release);
+    if (slot < registry_hint)
+    {
+        registry_hint = slot;
+    }
+    pthread_mutex_unlock(&registry_lock);
+    f->reg_slot = 0;
+}
+
 file_t my_fdopen(int fdes, IO_MODE mode)
 {
-    if (fdes < 0 || mode != READ || mode != WRITE)
+    if (fdes < 0 || (mode != READ && mode != WRITE))
     {
         return NULL;
     }
@@ -79,17 +344,13 @@ file_t my_fdopen(int fdes, IO_MODE mode)
         return NULL;
     }
 
-    file_t f = malloc(sizeof(MY_FILE));
+    file_t f = new_stream(fdes,mode);
     if (!f)
     {
         return NULL;
     }
 
-    memset(f,0,sizeof(MY_FILE));
-    f->fd = fdes;
-    f->imode = mode;
-
-    if (f->fd == STDERR_FILENO)
+    if (f->fd == STDERR_FILENO && mode == WRITE)
     {
         f->bmode = UNBUFFERED;
     } else if (isatty(f->fd))
@@ -97,27 +358,20 @@ file_t my_fdopen(int fdes, IO_MODE mode)
         f->bmode = LINE_BUFFERED;
         if (!f->buffer)
         {
-            f->buffer = malloc(sizeof(char) * BUFFER_SIZE);
-            if (!f->buffer)
-            {
-                free(f);
-                return -1;
-            }
+            f->buffer = inline_buffer(f);
+            f->buf_size = BUFFER_SIZE;
         }
     } else
     {
         f->bmode = FULLY_BUFFERED;
         if (!f->buffer)
         {
-            f->buffer = malloc(sizeof(char) * BUFFER_SIZE);
-            if (!f->buffer)
-            {
-                free(f);
-                return -1;
-            }
+            f->buffer = inline_buffer(f);
+            f->buf_size = BUFFER_SIZE;
         }
     }
 
+    register_stream(f);
     return f;
 }
 
@@ -144,189 +398,2360 @@ file_t my_fopen(const char *fname, const char *fmode)
     return f;
 }
 
-ssize_t my_fflush(file_t f)
+// Stream over a fixed caller buffer, "r" reads size bytes, "w" writes from the start, "a" appends
+// after the first NUL, writes past size fail with ENOSPC and no syscalls are ever made
+file_t my_fmemopen(void *buf, size_t size, const char *fmode)
 {
-    if (!f) 
+    IO_MODE m;
+    if (!buf || size == 0 || !fmode || mode_to_flags(fmode,&m) == -1)
     {
         errno = EINVAL;
-        return -1;
-        
+        return NULL;
     }
 
-    if (f->bmode == UNBUFFERED || f->imode == READ || f->bytes_in_buff == 0)
+    file_t f = new_stream(-1,m);
+    if (!f)
     {
-        return 0;
+        return NULL;
+    }
+
+    f->backend = MEM_FIXED;
+    f->bmode = FULLY_BUFFERED;
+    f->buffer = buf;
+    f->buf_size = size;
+
+    if (m == READ)
+    {
+        f->bytes_in_buf = size;
+    } else if (fmode[0] == 'a')
+    {
+        const char *nul = memchr(buf,'\0',size);
+        f->bytes_in_buf = nul ? (size_t)(nul - (const char *)buf) : size;
+    }
+
+    return f;
+}
+
+// Growable write stream, *ptr and *sizeloc are updated on my_fflush/my_fclose and the
+// caller frees *ptr after my_fclose, the contents are always NUL terminated
+file_t my_open_memstream(char **ptr, size_t *sizeloc)
+{
+    if (!ptr || !sizeloc)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    file_t f = new_stream(-1,WRITE);
+    if (!f)
+    {
+        return NULL;
+    }
+
+    f->buffer = malloc(BUFFER_SIZE);
+    if (!f->buffer)
+    {
+        release_stream(f);
+        return NULL;
+    }
+
+    f->backend = MEM_GROWABLE;
+    f->bmode = FULLY_BUFFERED;
+    f->buf_size = BUFFER_SIZE - 1; // Keep room for the terminating NUL
+    f->mem_ptr = ptr;
+    f->mem_size = sizeloc;
+    f->buffer[0] = '\0';
+    *ptr = f->buffer;
+    *sizeloc = 0;
+
+    return f;
+}
+
+#ifdef MYSTDIO_STATS
+
+#define STAT_ADD(f,field,n) __atomic_fetch_add(&(f)->stats.field,(unsigned long long)(n),__ATOMIC_RELAXED)
+
+static unsigned long long stat_clock(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Count one flush of bytes and file its latency, started at t0, into a log2 microsecond bucket
+static void stat_flush(file_t f, FLUSH_CAUSE cause, size_t bytes, unsigned long long t0)
+{
+    unsigned long long us = (stat_clock() - t0) / 1000;
+    int b = (us == 0) ? 0 : 64 - __builtin_clzll(us);
+    if (b >= STATS_BUCKETS)
+    {
+        b = STATS_BUCKETS - 1;
     }
 
-    ssize_t written = 0;
-    ssize_t bytes_to_write = f->bytes_in_buff;
-    while (written < bytes_to_write)
+    STAT_ADD(f,flushes[cause],1);
+    STAT_ADD(f,flushed_bytes,bytes);
+    STAT_ADD(f,flush_latency[b],1);
+}
+
+#define STAT_CLOCK() stat_clock()
+#define STAT_FLUSH(f,cause,bytes,t0) stat_flush(f,cause,bytes,t0)
+
+#else
+
+#define STAT_ADD(f,field,n) ((void)0)
+#define STAT_CLOCK() 0ULL
+#define STAT_FLUSH(f,cause,bytes,t0) ((void)(cause),(void)(t0))
+
+#endif
+
+// Write all len bytes of buf to the stream's fd, retrying on EINTR and short writes, returns 0 or
+// an errno value, safe to call from the flusher thread
+static int write_fd(file_t f, const char *buf, size_t len)
+{
+    size_t written = 0;
+    while (written < len)
     {
-        ssize_t w = write(f->fd,f->buffer + written,bytes_to_write-written);
+        ssize_t w = write(f->fd,buf + written,len - written);
+        STAT_ADD(f,write_calls,1);
         if (w < 0)
         {
             if (errno == EINTR)
             {
+                STAT_ADD(f,eintr_retries,1);
                 continue;
             }
-            f->err = errno;
-            return -1;
+            return errno;
         }
 
         if (w == 0) // Undefined behaviour, exit with error
         {
-            f->err = EIO;
-            return -1;
+            return EIO;
         }
 
+        STAT_ADD(f,bytes_written,w);
+        if ((size_t)w < len - written)
+        {
+            STAT_ADD(f,short_writes,1);
+        }
         written += w;
     }
 
-    f->bytes_in_buff = 0;
     return 0;
-    
 }
 
-int my_putc(char c, file_t f)
+// Write all len bytes of buf to the stream's fd, recording failures in f->err
+static int write_all(file_t f, const char *buf, size_t len)
 {
-    if (!f || f->imode == READ) {
-        errno = EINVAL;
+    int e = write_fd(f,buf,len);
+    if (e)
+    {
+        f->err = e;
+        errno = e;
         return -1;
     }
 
-    if (f->bmode == UNBUFFERED) {
-        ssize_t w = write(f->fd, &c, 1);
-        if (w < 0) {
+    return 0;
+}
+
+// writev the iovecs until all bytes are out, retrying on EINTR and resuming partial writes
+// *done is set to the number of bytes written even on failure
+static int writev_all(file_t f, struct iovec *iov, int cnt, size_t *done)
+{
+    *done = 0;
+    while (cnt > 0)
+    {
+        ssize_t w = writev(f->fd,iov,cnt);
+        STAT_ADD(f,write_calls,1);
+        if (w < 0)
+        {
+            if (errno == EINTR)
+            {
+                STAT_ADD(f,eintr_retries,1);
+                continue;
+            }
             f->err = errno;
             return -1;
         }
-        if (w == 0) {
+
+        if (w == 0)
+        {
             f->err = EIO;
             return -1;
         }
-        return (unsigned char)c;
-    }
 
-    // Buffered modes 
+        *done += w;
+        STAT_ADD(f,bytes_written,w);
 
-    if (f->bytes_in_buf == BUFFER_SIZE) {
-        if (my_fflush(f) < 0)
-            return -1;
+        // Skip fully written iovecs and trim the one we stopped in
+        size_t n = w;
+        while (cnt > 0 && n >= iov->iov_len)
+        {
+            n -= iov->iov_len;
+            iov++;
+            cnt--;
+        }
+        if (cnt > 0)
+        {
+            STAT_ADD(f,short_writes,1);
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
     }
 
-    f->buffer[f->bytes_in_buf++] = c;
+    return 0;
+}
 
-    if (f->bmode == LINE_BUFFERED && c == '\n') {
-        if (my_fflush(f) < 0)
-            return -1;
+void my_flockfile(file_t f)
+{
+    pthread_mutex_lock(&f->lock);
+}
+
+void my_funlockfile(file_t f)
+{
+    pthread_mutex_unlock(&f->lock);
+}
+
+// Write-behind for FULLY_BUFFERED streams: when the buffer fills it is swapped with a spare and
+// queued for one shared flusher thread, so the producer only blocks if the previous buffer is
+// still being written. Explicit flushes and close wait for the flusher and report its errors.
+static pthread_mutex_t async_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t async_work = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t async_done = PTHREAD_COND_INITIALIZER;
+static file_t async_head;
+static file_t async_tail;
+static int async_started;
+
+// Mark the background write of f finished and wake anyone waiting on it
+static void async_complete(file_t f, int e)
+{
+    pthread_mutex_lock(&async_lock);
+    if (e && !f->async_err)
+    {
+        f->async_err = e;
     }
+    f->inflight = 0;
+    pthread_cond_broadcast(&async_done);
+    pthread_mutex_unlock(&async_lock);
+}
 
-    return (unsigned char)c;
+// Detach the whole queue, blocking for work only when told to
+static file_t async_take_all(int block)
+{
+    pthread_mutex_lock(&async_lock);
+    while (block && !async_head)
+    {
+        pthread_cond_wait(&async_work,&async_lock);
+    }
+    file_t list = async_head;
+    async_head = NULL;
+    async_tail = NULL;
+    pthread_mutex_unlock(&async_lock);
+    return list;
 }
 
-int my_puts(const char *s, file_t f)
+#ifdef MYSTDIO_IO_URING
+
+// Minimal raw-syscall io_uring: one ring owned by the flusher thread
+typedef struct URING
+{
+    int fd;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned sq_mask;
+    unsigned *sq_array;
+    struct io_uring_sqe *sqes;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe *cqes;
+    unsigned pending; // Queued writes without a completion yet, including SQEs the kernel has not consumed
+} URING;
+
+static int uring_init(URING *r)
 {
+    struct io_uring_params p;
+    memset(&p,0,sizeof(p));
 
-    if (!f || !s || f->imode == READ) {
-        errno = EINVAL;
+    int fd = (int)syscall(__NR_io_uring_setup,URING_ENTRIES,&p);
+    if (fd < 0)
+    {
+        return -1;
+    }
+
+    // Writes at the current file position (offset -1) need 5.6+, fall back on older kernels
+    if (!(p.features & IORING_FEAT_RW_CUR_POS))
+    {
+        close(fd);
         return -1;
     }
 
-    const char *i = s;
-    int res;
-    while (*i != '\0')
+    size_t sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    size_t cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    int single = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single && cq_len > sq_len)
     {
-        res = my_putc(*i,f);
-        if (res == -1)
+        sq_len = cq_len;
+    }
+
+    char *sq = mmap(NULL,sq_len,PROT_READ | PROT_WRITE,MAP_SHARED | MAP_POPULATE,fd,IORING_OFF_SQ_RING);
+    if (sq == MAP_FAILED)
+    {
+        close(fd);
+        return -1;
+    }
+
+    char *cq = sq;
+    if (!single)
+    {
+        cq = mmap(NULL,cq_len,PROT_READ | PROT_WRITE,MAP_SHARED | MAP_POPULATE,fd,IORING_OFF_CQ_RING);
+        if (cq == MAP_FAILED)
         {
+            munmap(sq,sq_len);
+            close(fd);
             return -1;
         }
-        i++;
     }
-    res = my_putc('\n',f);
-    if (res == -1)
+
+    r->sqes = mmap(NULL,p.sq_entries * sizeof(struct io_uring_sqe),PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE,fd,IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED)
     {
+        if (!single)
+        {
+            munmap(cq,cq_len);
+        }
+        munmap(sq,sq_len);
+        close(fd);
         return -1;
     }
+
+    r->fd = fd;
+    r->sq_head = (unsigned *)(sq + p.sq_off.head);
+    r->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    r->sq_mask = *(unsigned *)(sq + p.sq_off.ring_mask);
+    r->sq_array = (unsigned *)(sq + p.sq_off.array);
+    r->cq_head = (unsigned *)(cq + p.cq_off.head);
+    r->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    r->cq_mask = *(unsigned *)(cq + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    r->pending = 0;
     return 0;
 }
 
-int my_fclose(file_t f)
+// Queue a write of the unwritten part of f's inflight buffer, the buffer stays pinned until its
+// completion because the producer cannot swap it back before async_complete
+static void uring_queue(URING *r, file_t f)
 {
-    if (!f) {
-        errno = EINVAL;
-        return -1;
-    }
-
-    if (f->imode == WRITE)
-        my_fflush(f);
-
-    int rc = close(f->fd);
-    int saved_errno = errno;
+    unsigned tail = *r->sq_tail;
+    unsigned idx = tail & r->sq_mask;
+    struct io_uring_sqe *sqe = &r->sqes[idx];
+
+    memset(sqe,0,sizeof(*sqe));
+    sqe->opcode = IORING_OP_WRITE;
+    sqe->fd = f->fd;
+    sqe->addr = (uint64_t)(uintptr_t)(f->inflight_buf + f->inflight_done);
+    sqe->len = (uint32_t)(f->inflight_len - f->inflight_done);
+    sqe->off = (uint64_t)-1;
+    sqe->user_data = (uint64_t)(uintptr_t)f;
+
+    r->sq_array[idx] = idx;
+    __atomic_store_n(r->sq_tail,tail + 1,__ATOMIC_RELEASE);
+    r->pending++;
+}
 
-    free(f->buffer);
-    free(f);
+// Reap every available completion, short and interrupted writes go back on *retry
+static void uring_reap(URING *r, file_t *retry)
+{
+    unsigned head = *r->cq_head;
+    unsigned tail = __atomic_load_n(r->cq_tail,__ATOMIC_ACQUIRE);
 
-    if (rc == -1) {
-        errno = saved_errno;
-        return -1;
+    while (head != tail)
+    {
+        struct io_uring_cqe *cqe = &r->cqes[head & r->cq_mask];
+        file_t f = (file_t)(uintptr_t)cqe->user_data;
+        int res = cqe->res;
+        head++;
+        r->pending--;
+        STAT_ADD(f,write_calls,1);
+
+        if (res == -EINTR || res == -EAGAIN)
+        {
+            STAT_ADD(f,eintr_retries,1);
+            f->async_next = *retry;
+            *retry = f;
+        } else if (res < 0)
+        {
+            async_complete(f,-res);
+        } else if (res == 0)
+        {
+            async_complete(f,EIO);
+        } else
+        {
+            f->inflight_done += res;
+            STAT_ADD(f,bytes_written,res);
+            if (f->inflight_done < f->inflight_len)
+            {
+                STAT_ADD(f,short_writes,1);
+                f->async_next = *retry;
+                *retry = f;
+            } else
+            {
+                async_complete(f,0);
+            }
+        }
     }
 
-    return 0;
+    __atomic_store_n(r->cq_head,head,__ATOMIC_RELEASE);
 }
 
-int my_printf(file_t f, const char *fmt, ...)
+// The ring failed: take back the SQEs the kernel has not consumed, wait out the submitted writes,
+// and leave every stream that is not done on *list
+static void uring_abandon(URING *r, file_t *list)
 {
-    if (!f || !fmt)
+    unsigned head = __atomic_load_n(r->sq_head,__ATOMIC_ACQUIRE);
+    unsigned tail = *r->sq_tail;
+    while (tail != head)
     {
-        errno = EINVAL;
-        return -1;
+        tail--;
+        file_t f = (file_t)(uintptr_t)r->sqes[r->sq_array[tail & r->sq_mask]].user_data;
+        f->async_next = *list;
+        *list = f;
+        r->pending--;
     }
+    __atomic_store_n(r->sq_tail,tail,__ATOMIC_RELEASE);
 
-    int count = 0;
-    const char *s = fmt;
-
-    va_list args;
-    va_start(args,fmt);
-
+    // Completions are still posted to the ring memory, sleeping gives the kernel a chance to run them
+    struct timespec nap = {0, 1000000}; // 1ms
+    while (r->pending)
+    {
+        uring_reap(r,list);
+        if (r->pending)
+        {
+            nanosleep(&nap,NULL);
+        }
+    }
+    close(r->fd);
+}
 
-    while (*s)
+// Batch every queued flush into SQEs, submit them with one io_uring_enter and reap completions
+// Only returns if the ring stops working, with the unfinished streams on *left
+static void uring_flusher(URING *r, file_t *left)
+{
+    file_t ready = NULL;
+    for (;;)
     {
-        if (*s != '%')
+        // Only sleep on the queue when the ring has nothing in flight
+        file_t more = async_take_all(!ready && r->pending == 0);
+        while (more)
         {
-            if (my_putc(*s,f) < 0)
-            {
-                goto error;
-            }
-            count++;
-            s++;
-            continue;
+            file_t next = more->async_next;
+            more->async_next = ready;
+            ready = more;
+            more = next;
         }
 
+        while (ready && r->pending < URING_ENTRIES)
+        {
+            file_t f = ready;
+            ready = f->async_next;
+            uring_queue(r,f);
+        }
+
+        // SQEs left over from a partial submit are still between sq_head and sq_tail and go in again
+        unsigned to_submit = *r->sq_tail - __atomic_load_n(r->sq_head,__ATOMIC_ACQUIRE);
+        if (!to_submit && r->pending == 0)
+        {
+            continue;
+        }
+
+        int rc = (int)syscall(__NR_io_uring_enter,r->fd,to_submit,1,IORING_ENTER_GETEVENTS,NULL,0);
+        if (rc < 0 && errno == EAGAIN)
+        {
+            struct timespec nap = {0, 1000000}; // 1ms
+            nanosleep(&nap,NULL); // Kernel is short of resources, the SQEs stay queued for the next try
+        } else if (rc < 0 && errno != EINTR && errno != EBUSY) // EBUSY: completion queue full, reaping frees it
+        {
+            // Ring is unusable, hand everything it holds back rather than hang the producers
+            uring_abandon(r,&ready);
+            *left = ready;
+            return;
+        }
+
+        uring_reap(r,&ready);
+    }
+}
+
+#endif
+
+static void *async_flusher(void *arg)
+{
+    (void)arg;
+    file_t list = NULL;
+
+#ifdef MYSTDIO_IO_URING
+    URING ring;
+    if (uring_init(&ring) == 0)
+    {
+        uring_flusher(&ring,&list); // Returns only when the ring fails, its leftovers are written below
+    }
+#endif
+
+    // Write each queued buffer (the rest of it after a partial ring write) with a blocking write loop
+    for (;;)
+    {
+        if (!list)
+        {
+            list = async_take_all(1);
+        }
+        while (list)
+        {
+            file_t f = list;
+            list = f->async_next;
+            async_complete(f,write_fd(f,f->inflight_buf + f->inflight_done,f->inflight_len - f->inflight_done));
+        }
+    }
+    return NULL;
+}
+
+// Wait until nothing of f is queued or being written, then surface any background error
+static int async_wait(file_t f)
+{
+    pthread_mutex_lock(&async_lock);
+    while (f->inflight)
+    {
+        pthread_cond_wait(&async_done,&async_lock);
+    }
+    int e = f->async_err;
+    f->async_err = 0;
+    pthread_mutex_unlock(&async_lock);
+
+    if (e)
+    {
+        f->err = e;
+        errno = e;
+        return -1;
+    }
+    return 0;
+}
+
+// Hand the full buffer to the flusher and continue in the spare
+static ssize_t async_submit(file_t f)
+{
+    unsigned long long t0 = STAT_CLOCK();
+    if (async_wait(f) < 0)
+    {
+        return -1;
+    }
+
+    char *full = f->buffer;
+    f->buffer = f->spare;
+    f->spare = full;
+
+    pthread_mutex_lock(&async_lock);
+    f->inflight_buf = full;
+    f->inflight_len = f->bytes_in_buf;
+    f->inflight_done = 0;
+    f->inflight = 1;
+    f->async_next = NULL;
+    if (async_tail)
+    {
+        async_tail->async_next = f;
+    } else
+    {
+        async_head = f;
+    }
+    async_tail = f;
+    pthread_cond_signal(&async_work);
+    pthread_mutex_unlock(&async_lock);
+
+    STAT_FLUSH(f,FLUSH_FULL,f->bytes_in_buf,t0);
+    f->bytes_in_buf = 0;
+    return 0;
+}
+
+// Memory streams have nothing to write out, a "flush" publishes the contents and makes room
+// by growing (memstream) or fails once the fixed buffer is full (fmemopen)
+static ssize_t sync_mem(file_t f)
+{
+    if (f->backend == MEM_GROWABLE)
+    {
+        if (f->bytes_in_buf == f->buf_size)
+        {
+            size_t cap = (f->buf_size + 1) * 2;
+            char *nbuf = realloc(f->buffer,cap);
+            if (!nbuf)
+            {
+                f->err = ENOMEM;
+                return -1;
+            }
+            f->buffer = nbuf;
+            f->buf_size = cap - 1;
+        }
+
+        f->buffer[f->bytes_in_buf] = '\0';
+        *f->mem_ptr = f->buffer;
+        *f->mem_size = f->bytes_in_buf;
+        return 0;
+    }
+
+    if (f->bytes_in_buf == f->buf_size)
+    {
+        f->err = ENOSPC;
+        errno = ENOSPC;
+        return -1;
+    }
+
+    f->buffer[f->bytes_in_buf] = '\0';
+    return 0;
+}
+
+// Write out pending bytes, caller must hold the stream lock
+static ssize_t flush_buffer(file_t f, FLUSH_CAUSE cause)
+{
+    unsigned long long t0 = STAT_CLOCK();
+
+    if (f->backend != FD_BACKED && f->imode == WRITE)
+    {
+        return sync_mem(f);
+    }
+
+    if (f->async && async_wait(f) < 0)
+    {
+        return -1;
+    }
+
+    if (f->bmode == UNBUFFERED || f->imode == READ || f->bytes_in_buf == 0)
+    {
+        return 0;
+    }
+
+    if (write_all(f,f->buffer,f->bytes_in_buf) < 0)
+    {
+        return -1;
+    }
+
+    STAT_FLUSH(f,cause,f->bytes_in_buf,t0);
+    f->bytes_in_buf = 0;
+    return 0;
+}
+
+// Free up buffer space for more output, async streams swap buffers instead of writing
+static ssize_t make_room(file_t f)
+{
+    return (f->async) ? async_submit(f) : flush_buffer(f,FLUSH_FULL);
+}
+
+// Turn write-behind on or off for a FULLY_BUFFERED fd stream, turning it off waits for the flusher
+int my_set_async(file_t f, int enable)
+{
+    if (!f)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    my_flockfile(f);
+    int res = 0;
+
+    if (enable && !f->async)
+    {
+        if (f->backend != FD_BACKED || f->imode != WRITE || f->bmode != FULLY_BUFFERED)
+        {
+            errno = EINVAL;
+            res = -1;
+            goto out;
+        }
+
+        pthread_mutex_lock(&async_lock);
+        if (!async_started)
+        {
+            pthread_t t;
+            int rc = pthread_create(&t,NULL,async_flusher,NULL);
+            if (rc == 0)
+            {
+                pthread_detach(t);
+                async_started = 1;
+            } else
+            {
+                errno = rc;
+            }
+        }
+        int started = async_started;
+        pthread_mutex_unlock(&async_lock);
+
+        f->async_alloc = started ? malloc(f->buf_size) : NULL;
+        if (!f->async_alloc)
+        {
+            res = -1;
+            goto out;
+        }
+        f->spare = f->async_alloc;
+        f->async = 1;
+    } else if (!enable && f->async)
+    {
+        res = (int)flush_buffer(f,FLUSH_EXPLICIT);
+
+        // Put the original buffer back in place so its owner can release it
+        if (f->buffer == f->async_alloc)
+        {
+            memcpy(f->spare,f->buffer,f->bytes_in_buf);
+            f->buffer = f->spare;
+        }
+        free(f->async_alloc);
+        f->async_alloc = NULL;
+        f->spare = NULL;
+        f->async = 0;
+    }
+
+out:
+    my_funlockfile(f);
+    return res;
+}
+
+static ssize_t flush_locked(file_t f, FLUSH_CAUSE cause)
+{
+    my_flockfile(f);
+    // A full fmemopen buffer has nothing left to publish, only making room for more fails
+    ssize_t res = (f->backend == MEM_FIXED && f->bytes_in_buf == f->buf_size) ? 0 : flush_buffer(f,cause);
+    my_funlockfile(f);
+    return res;
+}
+
+ssize_t my_fflush(file_t f)
+{
+    if (!f) 
+    {
+        errno = EINVAL;
+        return -1;
+        
+    }
+
+    return flush_locked(f,FLUSH_EXPLICIT);
+}
+
+// Copy the stream's counters into out, fails with ENOTSUP unless built with -DMYSTDIO_STATS
+int my_stats(file_t f, MY_STATS *out)
+{
+    if (!f || !out)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    memset(out,0,sizeof(*out));
+#ifdef MYSTDIO_STATS
+    my_flockfile(f);
+    const unsigned long long *src = (const unsigned long long *)&f->stats;
+    unsigned long long *dst = (unsigned long long *)out;
+    for (size_t i = 0; i < sizeof(*out) / sizeof(*dst); i++)
+    {
+        dst[i] = __atomic_load_n(&src[i],__ATOMIC_RELAXED);
+    }
+    my_funlockfile(f);
+    return 0;
+#else
+    errno = ENOTSUP;
+    return -1;
+#endif
+}
+
+// Change buffering mode and buffer, pending output is flushed first
+// buf != NULL: use the caller's buffer of size bytes, it must outlive the stream
+// buf == NULL: allocate size bytes (BUFFER_SIZE when size is 0)
+// UNBUFFERED write streams drop their buffer, UNBUFFERED read streams read one byte at a time
+int my_setvbuf(file_t f, char *buf, BUFFER_MODE mode, size_t size)
+{
+    if (!f || f->backend != FD_BACKED || f->async || (mode != UNBUFFERED && mode != LINE_BUFFERED && mode != FULLY_BUFFERED) || (buf && size == 0))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    my_flockfile(f);
+
+    if (flush_buffer(f,FLUSH_EXPLICIT) < 0)
+    {
+        my_funlockfile(f);
+        return -1;
+    }
+
+    if (f->imode == READ && f->read_pos != f->bytes_in_buf)
+    {
+        // Buffered input would be lost
+        my_funlockfile(f);
+        errno = EBUSY;
+        return -1;
+    }
+
+    char *nbuf = buf;
+    int owns = 0;
+    if (mode == UNBUFFERED)
+    {
+        size = (f->imode == READ) ? 1 : 0;
+    } else if (!size)
+    {
+        size = BUFFER_SIZE;
+    }
+
+    if (!nbuf && size && size <= BUFFER_SIZE)
+    {
+        nbuf = inline_buffer(f);
+    } else if (!nbuf && size)
+    {
+        nbuf = malloc(size);
+        if (!nbuf)
+        {
+            my_funlockfile(f);
+            return -1;
+        }
+        owns = 1;
+    }
+
+    if (f->owns_buf)
+    {
+        free(f->buffer);
+    }
+
+    f->buffer = nbuf;
+    f->buf_size = size;
+    f->owns_buf = owns;
+    f->bytes_in_buf = 0;
+    f->read_pos = 0;
+    f->bmode = mode;
+
+    my_funlockfile(f);
+    return 0;
+}
+
+int my_putc_unlocked(char c, file_t f)
+{
+    if (!f || f->imode == READ) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (f->bmode == UNBUFFERED) {
+        ssize_t w = write(f->fd, &c, 1);
+        STAT_ADD(f,write_calls,1);
+        if (w < 0) {
+            f->err = errno;
+            return -1;
+        }
+        if (w == 0) {
+            f->err = EIO;
+            return -1;
+        }
+        STAT_ADD(f,bytes_written,1);
+        return (unsigned char)c;
+    }
+
+    // Buffered modes 
+
+    if (f->bytes_in_buf == f->buf_size) {
+        if (make_room(f) < 0)
+            return -1;
+    }
+
+    f->buffer[f->bytes_in_buf++] = c;
+
+    if (f->bmode == LINE_BUFFERED && c == '\n') {
+        if (flush_buffer(f,FLUSH_NEWLINE) < 0)
+            return -1;
+    }
+
+    return (unsigned char)c;
+}
+
+size_t my_fwrite_unlocked(const void *ptr, size_t size, size_t nmemb, file_t f)
+{
+    if (!f || !ptr || f->imode == READ)
+    {
+        errno = EINVAL;
+        return 0;
+    }
+
+    if (size == 0 || nmemb == 0)
+    {
+        return 0;
+    }
+
+    if (nmemb > (size_t)-1 / size)
+    {
+        errno = EOVERFLOW;
+        return 0;
+    }
+
+    const char *src = (const char *)ptr;
+    size_t len = size * nmemb;
+
+    if (f->bmode == UNBUFFERED)
+    {
+        if (write_all(f,src,len) < 0)
+        {
+            return 0;
+        }
+        return nmemb;
+    }
+
+    // Payload at least a buffer long that does not fit: send pending bytes and payload
+    // together in one writev instead of copying the payload through the buffer
+    if (f->backend == FD_BACKED && !f->async && len >= f->buf_size && len > f->buf_size - f->bytes_in_buf)
+    {
+        size_t pending = f->bytes_in_buf;
+        struct iovec iov[2] = {
+            {f->buffer, pending},
+            {(void *)src, len}
+        };
+        size_t done;
+        unsigned long long t0 = STAT_CLOCK();
+        int rc = (pending) ? writev_all(f,iov,2,&done) : writev_all(f,iov + 1,1,&done);
+
+        if (done >= pending)
+        {
+            if (pending)
+            {
+                STAT_FLUSH(f,FLUSH_FULL,pending,t0); // The buffer went out with the payload
+            }
+            f->bytes_in_buf = 0;
+        } else
+        {
+            memmove(f->buffer,f->buffer + done,pending - done);
+            f->bytes_in_buf = pending - done;
+        }
+
+        if (rc < 0)
+        {
+            return (done > pending) ? (done - pending) / size : 0;
+        }
+        return nmemb;
+    }
+
+    // Line buffered streams send the pending bytes and the span through its last newline
+    // in one writev, only the bytes after the newline are buffered
+    size_t head = 0;
+    const char *last_nl = (f->bmode == LINE_BUFFERED && f->backend == FD_BACKED) ? memrchr(src,'\n',len) : NULL;
+    if (last_nl)
+    {
+        size_t pending = f->bytes_in_buf;
+        head = (last_nl + 1) - src;
+        struct iovec iov[2] = {
+            {f->buffer, pending},
+            {(void *)src, head}
+        };
+        size_t done;
+        unsigned long long t0 = STAT_CLOCK();
+        int rc = (pending) ? writev_all(f,iov,2,&done) : writev_all(f,iov + 1,1,&done);
+
+        if (rc < 0)
+        {
+            // Keep whatever did not go out buffered, the span still counts as written when
+            // it fits and the failed flush is left in f->err and errno
+            size_t keep = (done < pending) ? pending - done : 0;
+            size_t sent = (done > pending) ? done - pending : 0;
+            memmove(f->buffer,f->buffer + (pending - keep),keep);
+            f->bytes_in_buf = keep;
+            if (keep + len - sent > f->buf_size)
+            {
+                return sent / size;
+            }
+            memcpy(f->buffer + keep,src + sent,len - sent);
+            f->bytes_in_buf += len - sent;
+            return nmemb;
+        }
+        STAT_FLUSH(f,FLUSH_NEWLINE,pending + head,t0);
+        f->bytes_in_buf = 0;
+    }
+
+    // Copy whole spans into the buffer, flushing only when it fills up
+    size_t copied = head;
+    while (copied < len)
+    {
+        if (f->bytes_in_buf == f->buf_size)
+        {
+            if (make_room(f) < 0)
+            {
+                return copied / size;
+            }
+        }
+
+        size_t space = f->buf_size - f->bytes_in_buf;
+        size_t chunk = (len - copied < space) ? len - copied : space;
+        memcpy(f->buffer + f->bytes_in_buf,src + copied,chunk);
+        f->bytes_in_buf += chunk;
+        copied += chunk;
+    }
+
+    return nmemb;
+}
+
+int my_putc(char c, file_t f)
+{
+    if (!f)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    my_flockfile(f);
+    int res = my_putc_unlocked(c,f);
+    my_funlockfile(f);
+    return res;
+}
+
+size_t my_fwrite(const void *ptr, size_t size, size_t nmemb, file_t f)
+{
+    if (!f)
+    {
+        errno = EINVAL;
+        return 0;
+    }
+
+    my_flockfile(f);
+    size_t res = my_fwrite_unlocked(ptr,size,nmemb,f);
+    my_funlockfile(f);
+    return res;
+}
+
+int my_puts(const char *s, file_t f)
+{
+
+    if (!f || !s || f->imode == READ) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    size_t len = strlen(s);
+    int res = 0;
+    my_flockfile(f);
+    if ((len && my_fwrite_unlocked(s,1,len,f) != len) || my_putc_unlocked('\n',f) == -1)
+    {
+        res = -1;
+    }
+    my_funlockfile(f);
+    return res;
+}
+
+// Refill the buffer with one read, returns bytes read, 0 on EOF, -1 on error
+static ssize_t fill_buffer(file_t f)
+{
+    if (f->backend != FD_BACKED)
+    {
+        // A pushed back byte was consumed, carry on in the caller's buffer
+        if (f->pushed_buf)
+        {
+            f->buffer = f->pushed_buf;
+            f->bytes_in_buf = f->pushed_len;
+            f->read_pos = 0;
+            f->pushed_buf = NULL;
+            if (f->bytes_in_buf)
+            {
+                return f->bytes_in_buf;
+            }
+        }
+        f->eof = 1;
+        return 0;
+    }
+
+    ssize_t r;
+    for (;;)
+    {
+        r = read(f->fd,f->buffer,f->buf_size);
+        STAT_ADD(f,read_calls,1);
+        if (r >= 0 || errno != EINTR)
+        {
+            break;
+        }
+        STAT_ADD(f,eintr_retries,1);
+    }
+
+    if (r < 0)
+    {
+        f->err = errno;
+        return -1;
+    }
+    STAT_ADD(f,bytes_read,r);
+
+    if (r == 0)
+    {
+        f->eof = 1;
+    }
+
+    f->bytes_in_buf = r;
+    f->read_pos = 0;
+    return r;
+}
+
+int my_getc_unlocked(file_t f)
+{
+    if (!f || f->imode == WRITE)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (f->read_pos == f->bytes_in_buf)
+    {
+        if (fill_buffer(f) <= 0)
+        {
+            return -1;
+        }
+    }
+
+    return (unsigned char)f->buffer[f->read_pos++];
+}
+
+int my_ungetc_unlocked(int c, file_t f)
+{
+    if (!f || f->imode == WRITE || c == -1)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    // Never write into a fmemopen buffer: step back over an identical byte, or park the buffer and read c from
+    // the one-byte pushback slot until fill_buffer resumes it
+    if (f->backend == MEM_FIXED)
+    {
+        if (f->read_pos > 0 && f->buffer[f->read_pos - 1] == (char)c)
+        {
+            f->read_pos--;
+        } else if (f->buffer == &f->pushback)
+        {
+            if (f->read_pos == 0)
+            {
+                return -1; // Only one byte of pushback
+            }
+            f->pushback = (char)c;
+            f->read_pos = 0;
+        } else
+        {
+            f->pushed_buf = f->buffer + f->read_pos;
+            f->pushed_len = f->bytes_in_buf - f->read_pos;
+            f->pushback = (char)c;
+            f->buffer = &f->pushback;
+            f->bytes_in_buf = 1;
+            f->read_pos = 0;
+        }
+        f->eof = 0;
+        return (unsigned char)c;
+    }
+
+    if (f->read_pos == 0)
+    {
+        // Nothing consumed from this buffer yet, make room at the front
+        if (f->bytes_in_buf == f->buf_size)
+        {
+            return -1;
+        }
+        memmove(f->buffer + 1,f->buffer,f->bytes_in_buf);
+        f->bytes_in_buf++;
+    } else
+    {
+        f->read_pos--;
+    }
+
+    f->buffer[f->read_pos] = (char)c;
+    f->eof = 0;
+    return (unsigned char)c;
+}
+
+char *my_fgets_unlocked(char *s, int n, file_t f)
+{
+    if (!f || !s || n <= 0 || f->imode == WRITE)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    size_t want = n - 1;
+    size_t got = 0;
+    while (got < want)
+    {
+        if (f->read_pos == f->bytes_in_buf)
+        {
+            ssize_t r = fill_buffer(f);
+            if (r < 0)
+            {
+                return NULL;
+            }
+            if (r == 0)
+            {
+                break;
+            }
+        }
+
+        // Copy up to the newline (inclusive) straight out of the buffer
+        size_t avail = f->bytes_in_buf - f->read_pos;
+        size_t chunk = (want - got < avail) ? want - got : avail;
+        const char *start = f->buffer + f->read_pos;
+        const char *nl = memchr(start,'\n',chunk);
+        if (nl)
+        {
+            chunk = nl - start + 1;
+        }
+
+        memcpy(s + got,start,chunk);
+        f->read_pos += chunk;
+        got += chunk;
+
+        if (nl)
+        {
+            break;
+        }
+    }
+
+    if (got == 0 && want > 0)
+    {
+        return NULL;
+    }
+
+    s[got] = '\0';
+    return s;
+}
+
+size_t my_fread_unlocked(void *ptr, size_t size, size_t nmemb, file_t f)
+{
+    if (!f || !ptr || f->imode == WRITE)
+    {
+        errno = EINVAL;
+        return 0;
+    }
+
+    if (size == 0 || nmemb == 0)
+    {
+        return 0;
+    }
+
+    if (nmemb > (size_t)-1 / size)
+    {
+        errno = EOVERFLOW;
+        return 0;
+    }
+
+    char *dst = (char *)ptr;
+    size_t len = size * nmemb;
+    size_t got = 0;
+
+    // Drain what is already buffered
+    size_t avail = f->bytes_in_buf - f->read_pos;
+    if (avail)
+    {
+        size_t chunk = (len < avail) ? len : avail;
+        memcpy(dst,f->buffer + f->read_pos,chunk);
+        f->read_pos += chunk;
+        got += chunk;
+    }
+
+    while (got < len)
+    {
+        size_t remaining = len - got;
+        ssize_t r;
+
+        if (remaining >= f->buf_size && f->backend == FD_BACKED)
+        {
+            // Large request, read straight into the caller's buffer
+            r = read(f->fd,dst + got,remaining);
+            STAT_ADD(f,read_calls,1);
+            if (r < 0)
+            {
+                if (errno == EINTR)
+                {
+                    STAT_ADD(f,eintr_retries,1);
+                    continue;
+                }
+                f->err = errno;
+                break;
+            }
+            if (r == 0)
+            {
+                f->eof = 1;
+                break;
+            }
+            STAT_ADD(f,bytes_read,r);
+            got += r;
+            continue;
+        }
+
+        r = fill_buffer(f);
+        if (r <= 0)
+        {
+            break;
+        }
+        size_t chunk = (remaining < (size_t)r) ? remaining : (size_t)r;
+        memcpy(dst + got,f->buffer,chunk);
+        f->read_pos = chunk;
+        got += chunk;
+    }
+
+    return got / size;
+}
+
+int my_getc(file_t f)
+{
+    if (!f)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    my_flockfile(f);
+    int res = my_getc_unlocked(f);
+    my_funlockfile(f);
+    return res;
+}
+
+int my_ungetc(int c, file_t f)
+{
+    if (!f)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    my_flockfile(f);
+    int res = my_ungetc_unlocked(c,f);
+    my_funlockfile(f);
+    return res;
+}
+
+char *my_fgets(char *s, int n, file_t f)
+{
+    if (!f)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    my_flockfile(f);
+    char *res = my_fgets_unlocked(s,n,f);
+    my_funlockfile(f);
+    return res;
+}
+
+size_t my_fread(void *ptr, size_t size, size_t nmemb, file_t f)
+{
+    if (!f)
+    {
+        errno = EINVAL;
+        return 0;
+    }
+
+    my_flockfile(f);
+    size_t res = my_fread_unlocked(ptr,size,nmemb,f);
+    my_funlockfile(f);
+    return res;
+}
+
+// Flush every registered stream, runs automatically at exit
+void my_flush_all(void)
+{
+    pthread_mutex_lock(&registry_lock);
+    for (size_t c = 0; c < REGISTRY_CHUNKS; c++)
+    {
+        _Atomic(file_t) *chunk = atomic_load(&registry[c]);
+        if (!chunk)
+        {
+            break;
+        }
+        for (size_t i = 0; i < REGISTRY_CHUNK; i++)
+        {
+            file_t f = atomic_load_explicit(&chunk[i],memory_order_acquire);
+            if (f)
+            {
+                my_fflush(f);
+            }
+        }
+    }
+    pthread_mutex_unlock(&registry_lock);
+}
+
+// Emergency flush for SIGTERM/SIGSEGV handlers: only write() and atomics are used, no locks
+// or allocation, so a stream another thread is writing to at that moment may lose or repeat bytes
+void my_flush_all_signal(void)
+{
+    int saved_errno = errno;
+    for (size_t c = 0; c < REGISTRY_CHUNKS; c++)
+    {
+        _Atomic(file_t) *chunk = atomic_load(&registry[c]);
+        if (!chunk)
+        {
+            break;
+        }
+        for (size_t i = 0; i < REGISTRY_CHUNK; i++)
+        {
+            file_t f = atomic_load_explicit(&chunk[i],memory_order_acquire);
+            if (!f || f->imode != WRITE || f->bmode == UNBUFFERED || !f->buffer)
+            {
+                continue;
+            }
+
+            size_t len = f->bytes_in_buf;
+            size_t written = 0;
+            while (written < len)
+            {
+                ssize_t w = write(f->fd,f->buffer + written,len - written);
+                if (w < 0 && errno == EINTR)
+                {
+                    continue;
+                }
+                if (w <= 0)
+                {
+                    break;
+                }
+                written += w;
+            }
+            if (written == len)
+            {
+                f->bytes_in_buf = 0;
+            }
+        }
+    }
+    errno = saved_errno;
+}
+
+int my_fclose(file_t f)
+{
+    if (!f) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    unregister_stream(f);
+
+    // The stream is released whatever happens, the first failed flush or background write is reported
+    int saved_errno = 0;
+
+    if (f->imode == WRITE && flush_locked(f,FLUSH_CLOSE) < 0)
+        saved_errno = errno;
+
+    if (f->async && my_set_async(f,0) < 0 && !saved_errno)
+        saved_errno = errno;
+
+    if (f->backend != FD_BACKED)
+    {
+        // The memory belongs to the caller (fmemopen) or is handed over through *ptr (memstream)
+        f->owns_buf = 0;
+        release_stream(f);
+    } else
+    {
+        if (close(f->fd) == -1 && !saved_errno)
+            saved_errno = errno;
+
+        release_stream(f);
+    }
+
+    if (saved_errno) {
+        errno = saved_errno;
+        return -1;
+    }
+
+    return 0;
+}
+
+// Parsed %[flags][width][.precision][length]conv directive
+typedef struct FMT_SPEC
+{
+    int left;      // '-' flag
+    int zero;      // '0' flag
+    int width;
+    int precision; // -1 when not given
+    int length;    // 0 int, 1 long, 2 long long, 3 size_t, 4 short, 5 char
+    int shortest;  // '~' flag: %f %e %g without a precision print the shortest round-trip digits
+    char sign;     // '+' or ' ' flag: shown before non-negative %d %i and floats, 0 for none
+    int alt;       // '#' flag: 0x/0X on nonzero %x %X, floats always keep the point and %g its zeros
+} FMT_SPEC;
+
+// Two ASCII digits per value 0..99, also used by my_format.hpp
+const char my_digit_pairs[201] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+static int count_digits(unsigned long long v, int base)
+{
+    int n = 1;
+    if (base == 16)
+    {
+        while (v >>= 4)
+        {
+            n++;
+        }
+        return n;
+    }
+
+    for (;;)
+    {
+        if (v < 10) return n;
+        if (v < 100) return n + 1;
+        if (v < 1000) return n + 2;
+        if (v < 10000) return n + 3;
+        v /= 10000;
+        n += 4;
+    }
+}
+
+// Write exactly ndigits digits of v so that the last one lands at end[-1]
+static void write_digits(char *end, unsigned long long v, int base, int upper)
+{
+    if (base == 16)
+    {
+        const char *hex = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+        do
+        {
+            *--end = hex[v & 0xf];
+            v >>= 4;
+        } while (v);
+        return;
+    }
+
+    while (v > 0xffffffffULL)
+    {
+        unsigned idx = (unsigned)(v % 100) * 2;
+        v /= 100;
+        *--end = my_digit_pairs[idx + 1];
+        *--end = my_digit_pairs[idx];
+    }
+
+    // Finish in 32-bit arithmetic, which is much cheaper to divide
+    unsigned w = (unsigned)v;
+    while (w >= 100)
+    {
+        unsigned idx = (w % 100) * 2;
+        w /= 100;
+        *--end = my_digit_pairs[idx + 1];
+        *--end = my_digit_pairs[idx];
+    }
+
+    if (w >= 10)
+    {
+        *--end = my_digit_pairs[w * 2 + 1];
+        *--end = my_digit_pairs[w * 2];
+    } else
+    {
+        *--end = (char)('0' + w);
+    }
+}
+
+// Emit n copies of ch through the buffer
+static int pad_unlocked(file_t f, char ch, int n)
+{
+    char pad[64];
+    memset(pad,ch,(n < 64) ? n : 64);
+    while (n > 0)
+    {
+        size_t chunk = (n < 64) ? n : 64;
+        if (my_fwrite_unlocked(pad,1,chunk,f) != chunk)
+        {
+            return -1;
+        }
+        n -= chunk;
+    }
+    return 0;
+}
+
+// Format one integer, digits are written straight into the stream buffer when it is buffered
+static int emit_int(file_t f, unsigned long long mag, const char *prefix, int base, int upper, const FMT_SPEC *sp)
+{
+    int ndigits = (sp->precision == 0 && mag == 0) ? 0 : count_digits(mag,base);
+    int zeros = (sp->precision > ndigits) ? sp->precision - ndigits : 0;
+    int plen = (int)strlen(prefix);
+    int pad = (sp->width > plen + zeros + ndigits) ? sp->width - (plen + zeros + ndigits) : 0;
+
+    if (sp->zero && !sp->left && sp->precision < 0)
+    {
+        zeros += pad;
+        pad = 0;
+    }
+
+    if (!sp->left && pad && pad_unlocked(f,' ',pad) < 0)
+    {
+        return -1;
+    }
+    if (plen && my_fwrite_unlocked(prefix,1,plen,f) != (size_t)plen)
+    {
+        return -1;
+    }
+    if (zeros && pad_unlocked(f,'0',zeros) < 0)
+    {
+        return -1;
+    }
+
+    if (ndigits)
+    {
+        if (f->bmode != UNBUFFERED && f->buf_size - f->bytes_in_buf < (size_t)ndigits && make_room(f) < 0)
+        {
+            return -1;
+        }
+
+        if (f->bmode != UNBUFFERED && f->buf_size - f->bytes_in_buf >= (size_t)ndigits)
+        {
+            write_digits(f->buffer + f->bytes_in_buf + ndigits,mag,base,upper);
+            f->bytes_in_buf += ndigits;
+        } else
+        {
+            // Unbuffered, or a buffer too small to take the digits in one piece
+            char digits[24];
+            write_digits(digits + ndigits,mag,base,upper);
+            if (my_fwrite_unlocked(digits,1,ndigits,f) != (size_t)ndigits)
+            {
+                return -1;
+            }
+        }
+    }
+
+    if (sp->left && pad && pad_unlocked(f,' ',pad) < 0)
+    {
+        return -1;
+    }
+
+    return plen + zeros + ndigits + pad;
+}
+
+// Emit a string span with width padding, precision caps the number of bytes
+static int emit_str(file_t f, const char *str, size_t len, const FMT_SPEC *sp)
+{
+    if (sp->precision >= 0 && (size_t)sp->precision < len)
+    {
+        len = sp->precision;
+    }
+    int pad = (sp->width > 0 && (size_t)sp->width > len) ? sp->width - (int)len : 0;
+
+    if (!sp->left && pad && pad_unlocked(f,' ',pad) < 0)
+    {
+        return -1;
+    }
+    if (len && my_fwrite_unlocked(str,1,len,f) != len)
+    {
+        return -1;
+    }
+    if (sp->left && pad && pad_unlocked(f,' ',pad) < 0)
+    {
+        return -1;
+    }
+
+    return (int)len + pad;
+}
+
+// Emit prefix + body with width padding, the '0' flag pads between them
+static int emit_padded(file_t f, const char *prefix, const char *body, size_t len, const FMT_SPEC *sp)
+{
+    size_t plen = strlen(prefix);
+    int pad = (sp->width > 0 && (size_t)sp->width > plen + len) ? sp->width - (int)(plen + len) : 0;
+    int zeros = (sp->zero && !sp->left) ? pad : 0;
+    if (zeros)
+    {
+        pad = 0;
+    }
+
+    if (!sp->left && pad && pad_unlocked(f,' ',pad) < 0)
+    {
+        return -1;
+    }
+    if (plen && my_fwrite_unlocked(prefix,1,plen,f) != plen)
+    {
+        return -1;
+    }
+    if (zeros && pad_unlocked(f,'0',zeros) < 0)
+    {
+        return -1;
+    }
+    if (len && my_fwrite_unlocked(body,1,len,f) != len)
+    {
+        return -1;
+    }
+    if (sp->left && pad && pad_unlocked(f,' ',pad) < 0)
+    {
+        return -1;
+    }
+
+    return (int)(plen + len) + pad + zeros;
+}
+
+// Shortest round-trip double to digits (Grisu2, after Loitsch 2010)
+// Produces digits d[0..len) such that value == 0.d * 10^(len + K), with no bignum arithmetic
+
+typedef struct DIY_FP
+{
+    uint64_t f;
+    int e;
+} DIY_FP;
+
+#define DP_SIGNIFICAND_MASK 0x000FFFFFFFFFFFFFULL
+#define DP_HIDDEN_BIT 0x0010000000000000ULL
+#define DP_EXPONENT_BIAS (0x3FF + 52)
+
+// Normalized 10^k for k = -348, -340, ..., 340
+static const uint64_t cached_powers_f[] =
+{
+    0xfa8fd5a0081c0288ULL, 0xbaaee17fa23ebf76ULL, 0x8b16fb203055ac76ULL, 0xcf42894a5dce35eaULL,
+    0x9a6bb0aa55653b2dULL, 0xe61acf033d1a45dfULL, 0xab70fe17c79ac6caULL, 0xff77b1fcbebcdc4fULL,
+    0xbe5691ef416bd60cULL, 0x8dd01fad907ffc3cULL, 0xd3515c2831559a83ULL, 0x9d71ac8fada6c9b5ULL,
+    0xea9c227723ee8bcbULL, 0xaecc49914078536dULL, 0x823c12795db6ce57ULL, 0xc21094364dfb5637ULL,
+    0x9096ea6f3848984fULL, 0xd77485cb25823ac7ULL, 0xa086cfcd97bf97f4ULL, 0xef340a98172aace5ULL,
+    0xb23867fb2a35b28eULL, 0x84c8d4dfd2c63f3bULL, 0xc5dd44271ad3cdbaULL, 0x936b9fcebb25c996ULL,
+    0xdbac6c247d62a584ULL, 0xa3ab66580d5fdaf6ULL, 0xf3e2f893dec3f126ULL, 0xb5b5ada8aaff80b8ULL,
+    0x87625f056c7c4a8bULL, 0xc9bcff6034c13053ULL, 0x964e858c91ba2655ULL, 0xdff9772470297ebdULL,
+    0xa6dfbd9fb8e5b88fULL, 0xf8a95fcf88747d94ULL, 0xb94470938fa89bcfULL, 0x8a08f0f8bf0f156bULL,
+    0xcdb02555653131b6ULL, 0x993fe2c6d07b7facULL, 0xe45c10c42a2b3b06ULL, 0xaa242499697392d3ULL,
+    0xfd87b5f28300ca0eULL, 0xbce5086492111aebULL, 0x8cbccc096f5088ccULL, 0xd1b71758e219652cULL,
+    0x9c40000000000000ULL, 0xe8d4a51000000000ULL, 0xad78ebc5ac620000ULL, 0x813f3978f8940984ULL,
+    0xc097ce7bc90715b3ULL, 0x8f7e32ce7bea5c70ULL, 0xd5d238a4abe98068ULL, 0x9f4f2726179a2245ULL,
+    0xed63a231d4c4fb27ULL, 0xb0de65388cc8ada8ULL, 0x83c7088e1aab65dbULL, 0xc45d1df942711d9aULL,
+    0x924d692ca61be758ULL, 0xda01ee641a708deaULL, 0xa26da3999aef774aULL, 0xf209787bb47d6b85ULL,
+    0xb454e4a179dd1877ULL, 0x865b86925b9bc5c2ULL, 0xc83553c5c8965d3dULL, 0x952ab45cfa97a0b3ULL,
+    0xde469fbd99a05fe3ULL, 0xa59bc234db398c25ULL, 0xf6c69a72a3989f5cULL, 0xb7dcbf5354e9beceULL,
+    0x88fcf317f22241e2ULL, 0xcc20ce9bd35c78a5ULL, 0x98165af37b2153dfULL, 0xe2a0b5dc971f303aULL,
+    0xa8d9d1535ce3b396ULL, 0xfb9b7cd9a4a7443cULL, 0xbb764c4ca7a44410ULL, 0x8bab8eefb6409c1aULL,
+    0xd01fef10a657842cULL, 0x9b10a4e5e9913129ULL, 0xe7109bfba19c0c9dULL, 0xac2820d9623bf429ULL,
+    0x80444b5e7aa7cf85ULL, 0xbf21e44003acdd2dULL, 0x8e679c2f5e44ff8fULL, 0xd433179d9c8cb841ULL,
+    0x9e19db92b4e31ba9ULL, 0xeb96bf6ebadf77d9ULL, 0xaf87023b9bf0ee6bULL
+};
+
+static const int16_t cached_powers_e[] =
+{
+    -1220, -1193, -1166, -1140, -1113, -1087, -1060, -1034, -1007, -980, -954, -927,
+    -901, -874, -847, -821, -794, -768, -741, -715, -688, -661, -635, -608,
+    -582, -555, -529, -502, -475, -449, -422, -396, -369, -343, -316, -289,
+    -263, -236, -210, -183, -157, -130, -103, -77, -50, -24, 3, 30,
+    56, 83, 109, 136, 162, 189, 216, 242, 269, 295, 322, 348,
+    375, 402, 428, 455, 481, 508, 534, 561, 588, 614, 641, 667,
+    694, 720, 747, 774, 800, 827, 853, 880, 907, 933, 960, 986,
+    1013, 1039, 1066
+};
+
+static const uint64_t pow10_u64[] =
+{
+    1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL, 10000000ULL,
+    100000000ULL, 1000000000ULL, 10000000000ULL, 100000000000ULL, 1000000000000ULL,
+    10000000000000ULL, 100000000000000ULL, 1000000000000000ULL, 10000000000000000ULL,
+    100000000000000000ULL, 1000000000000000000ULL, 10000000000000000000ULL
+};
+
+static DIY_FP diy_mul(DIY_FP x, DIY_FP y)
+{
+    const uint64_t m32 = 0xFFFFFFFFULL;
+    uint64_t a = x.f >> 32, b = x.f & m32, c = y.f >> 32, d = y.f & m32;
+    uint64_t ac = a * c, bc = b * c, ad = a * d, bd = b * d;
+    uint64_t tmp = (bd >> 32) + (ad & m32) + (bc & m32);
+    tmp += 1ULL << 31; // Round
+    DIY_FP r = {ac + (ad >> 32) + (bc >> 32) + (tmp >> 32), x.e + y.e + 64};
+    return r;
+}
+
+static DIY_FP diy_normalize(DIY_FP x)
+{
+    while (!(x.f & (1ULL << 63)))
+    {
+        x.f <<= 1;
+        x.e--;
+    }
+    return x;
+}
+
+static void grisu_round(char *buf, int len, uint64_t delta, uint64_t rest, uint64_t ten_kappa, uint64_t wp_w)
+{
+    while (rest < wp_w && delta - rest >= ten_kappa &&
+           (rest + ten_kappa < wp_w || wp_w - rest > rest + ten_kappa - wp_w))
+    {
+        buf[len - 1]--;
+        rest += ten_kappa;
+    }
+}
+
+static int grisu2(double value, char *buf, int *K)
+{
+    uint64_t bits;
+    memcpy(&bits,&value,sizeof(bits));
+
+    int biased_e = (int)((bits >> 52) & 0x7FF);
+    DIY_FP v;
+    v.f = bits & DP_SIGNIFICAND_MASK;
+    if (biased_e)
+    {
+        v.f += DP_HIDDEN_BIT;
+        v.e = biased_e - DP_EXPONENT_BIAS;
+    } else
+    {
+        v.e = 1 - DP_EXPONENT_BIAS;
+    }
+
+    // Boundaries m- and m+ halfway to the neighbouring doubles
+    DIY_FP plus = {(v.f << 1) + 1, v.e - 1};
+    while (!(plus.f & (DP_HIDDEN_BIT << 1)))
+    {
+        plus.f <<= 1;
+        plus.e--;
+    }
+    plus.f <<= 64 - 52 - 2;
+    plus.e -= 64 - 52 - 2;
+
+    DIY_FP minus = (v.f == DP_HIDDEN_BIT) ? (DIY_FP){(v.f << 2) - 1, v.e - 2} : (DIY_FP){(v.f << 1) - 1, v.e - 1};
+    minus.f <<= minus.e - plus.e;
+    minus.e = plus.e;
+
+    // Pick the cached power that brings the scaled exponent into [-60, -32]
+    double dk = (-61 - plus.e) * 0.30102999566398114 + 347;
+    int k = (int)dk;
+    if (dk - k > 0.0)
+    {
+        k++;
+    }
+    unsigned index = (unsigned)((k >> 3) + 1);
+    *K = -(-348 + (int)(index << 3));
+    DIY_FP c_mk = {cached_powers_f[index], cached_powers_e[index]};
+
+    DIY_FP W = diy_mul(diy_normalize(v),c_mk);
+    DIY_FP Wp = diy_mul(plus,c_mk);
+    DIY_FP Wm = diy_mul(minus,c_mk);
+    Wm.f++;
+    Wp.f--;
+
+    // Generate digits of Wp until they fall within delta of it
+    uint64_t delta = Wp.f - Wm.f;
+    int shift = -Wp.e;
+    uint64_t one = 1ULL << shift;
+    uint64_t wp_w = Wp.f - W.f;
+    uint32_t p1 = (uint32_t)(Wp.f >> shift);
+    uint64_t p2 = Wp.f & (one - 1);
+
+    int kappa = 1;
+    while (kappa < 10 && p1 >= pow10_u64[kappa])
+    {
+        kappa++;
+    }
+
+    int len = 0;
+    while (kappa > 0)
+    {
+        uint32_t d = p1 / (uint32_t)pow10_u64[kappa - 1];
+        p1 %= (uint32_t)pow10_u64[kappa - 1];
+        if (d || len)
+        {
+            buf[len++] = (char)('0' + d);
+        }
+        kappa--;
+
+        uint64_t rest = ((uint64_t)p1 << shift) + p2;
+        if (rest <= delta)
+        {
+            *K += kappa;
+            grisu_round(buf,len,delta,rest,pow10_u64[kappa] << shift,wp_w);
+            return len;
+        }
+    }
+
+    for (;;)
+    {
+        p2 *= 10;
+        delta *= 10;
+        char d = (char)(p2 >> shift);
+        if (d || len)
+        {
+            buf[len++] = (char)('0' + d);
+        }
+        p2 &= one - 1;
+        kappa--;
+
+        if (p2 < delta)
+        {
+            *K += kappa;
+            int idx = -kappa;
+            grisu_round(buf,len,delta,p2,one,wp_w * (idx < 20 ? pow10_u64[idx] : 0));
+            return len;
+        }
+    }
+}
+
+// Round the digit string to n significant digits, n <= 0 rounds to the leading power of ten or zero
+// The digits must be exact (see exact_digits): a lone trailing 5 is a tie and rounds to even
+// Returns the new length, *exp10 is the decimal exponent of buf[0] and moves up on carry-out
+static int round_digits(char *buf, int len, int n, int *exp10)
+{
+    if (n >= len)
+    {
+        return len;
+    }
+
+    if (n < 0)
+    {
+        return 0;
+    }
+
+    int tie = (buf[n] == '5' && n + 1 == len);
+    if (n == 0 && (buf[0] < '5' || tie))
+    {
+        return 0;
+    }
+
+    if (n == 0)
+    {
+        buf[0] = '1';
+        (*exp10)++;
+        return 1;
+    }
+
+    if (buf[n] > '5' || (buf[n] == '5' && (!tie || (buf[n - 1] - '0') % 2)))
+    {
+        int i = n - 1;
+        while (i >= 0 && buf[i] == '9')
+        {
+            i--;
+        }
+        if (i < 0)
+        {
+            buf[0] = '1';
+            (*exp10)++;
+            return 1;
+        }
+        buf[i]++;
+        n = i + 1;
+    }
+
+    while (n > 1 && buf[n - 1] == '0')
+    {
+        n--;
+    }
+    return n;
+}
+
+#define FLOAT_MAX_PRECISION 400
+#define FLOAT_BUF_SIZE 768
+#define EXACT_LIMBS 36 // 32-bit limbs, enough for the 1024 integer or 1074 fraction bits of a double
+
+// Decimal digits of v >= 0 computed from its exact binary value, for correctly rounded fixed precision
+// Stops after max_sig significant digits or max_frac digits past the point, and appends a sticky '1'
+// when nonzero digits were cut off, so round_digits can tell ties from values above them
+// Returns the digit count (0 if no significant digit came before the cut), *exp10 is the exponent of out[0]
+static int exact_digits(double v, int max_sig, int max_frac, char *out, int *exp10)
+{
+    uint64_t bits;
+    memcpy(&bits,&v,sizeof(bits));
+    int biased_e = (int)((bits >> 52) & 0x7FF);
+    uint64_t m = bits & DP_SIGNIFICAND_MASK;
+    int e = biased_e ? biased_e - DP_EXPONENT_BIAS : 1 - DP_EXPONENT_BIAS;
+    if (biased_e)
+    {
+        m += DP_HIDDEN_BIT;
+    }
+
+    // Integer part m * 2^e, or the bits of m above the point
+    uint32_t n[EXACT_LIMBS];
+    memset(n,0,sizeof(n));
+    int nl;
+    if (e >= 0)
+    {
+        int w = e / 32, b = e % 32;
+        n[w] = (uint32_t)m << b;
+        n[w + 1] = (uint32_t)(m >> (32 - b));
+        n[w + 2] = b ? (uint32_t)(m >> (64 - b)) : 0;
+        nl = w + 3;
+    } else
+    {
+        uint64_t ip = (-e < 64) ? m >> -e : 0;
+        n[0] = (uint32_t)ip;
+        n[1] = (uint32_t)(ip >> 32);
+        nl = 2;
+    }
+
+    // Peel off base 10^9 chunks, the digits come out least significant first
+    char ibuf[320];
+    int il = 0;
+    while (nl > 0 && n[nl - 1] == 0)
+    {
+        nl--;
+    }
+    while (nl > 0)
+    {
+        uint64_t rem = 0;
+        for (int i = nl - 1; i >= 0; i--)
+        {
+            uint64_t cur = (rem << 32) | n[i];
+            n[i] = (uint32_t)(cur / 1000000000);
+            rem = cur % 1000000000;
+        }
+        while (nl > 0 && n[nl - 1] == 0)
+        {
+            nl--;
+        }
+        for (int k = 0; k < 9 && (nl > 0 || rem); k++)
+        {
+            ibuf[il++] = (char)('0' + rem % 10);
+            rem /= 10;
+        }
+    }
+
+    int len = 0, sticky = 0;
+    *exp10 = il - 1;
+    for (int i = il - 1; i >= 0; i--)
+    {
+        if (len < max_sig)
+        {
+            out[len++] = ibuf[i];
+        } else if (ibuf[i] != '0')
+        {
+            sticky = 1;
+        }
+    }
+
+    // Fraction as a fixed-point number with the point above limb L - 1, each *10 carries out the next digit
+    if (e < 0)
+    {
+        int sh = -e;
+        int L = (sh + 31) / 32;
+        uint64_t frac = (sh < 64) ? m & ((1ULL << sh) - 1) : m;
+        int up = 32 * L - sh;
+        uint32_t fr[EXACT_LIMBS];
+        memset(fr,0,sizeof(fr));
+        fr[0] = (uint32_t)(frac << up);
+        fr[1] = (uint32_t)((frac << up) >> 32);
+        fr[2] = up ? (uint32_t)(frac >> (64 - up)) : 0;
+
+        int lo = 0; // Limbs below lo are zero, every *10 clears one more low bit
+        int fd = 0;
+        while (lo < L && fr[lo] == 0)
+        {
+            lo++;
+        }
+        while (lo < L && len < max_sig && fd < max_frac)
+        {
+            uint64_t carry = 0;
+            for (int i = lo; i < L; i++)
+            {
+                uint64_t cur = (uint64_t)fr[i] * 10 + carry;
+                fr[i] = (uint32_t)cur;
+                carry = cur >> 32;
+            }
+            while (lo < L && fr[lo] == 0)
+            {
+                lo++;
+            }
+
+            fd++;
+            if (len == 0 && carry == 0)
+            {
+                continue; // Leading zeros of a value below 1
+            }
+            if (len == 0)
+            {
+                *exp10 = -fd;
+            }
+            out[len++] = (char)('0' + carry);
+        }
+        sticky |= lo < L;
+    }
+
+    if (len == 0)
+    {
+        *exp10 = 0;
+        return 0;
+    }
+
+    if (sticky)
+    {
+        out[len++] = '1';
+        return len;
+    }
+
+    while (len > 1 && out[len - 1] == '0')
+    {
+        len--;
+    }
+    return len;
+}
+
+// Fixed notation with prec fraction digits, digits beyond len read as zero
+static int fmt_fixed(char *out, const char *d, int len, int exp10, int prec)
+{
+    int o = 0;
+    if (exp10 < 0)
+    {
+        out[o++] = '0';
+    } else
+    {
+        for (int i = 0; i <= exp10; i++)
+        {
+            out[o++] = (i < len) ? d[i] : '0';
+        }
+    }
+
+    if (prec > 0)
+    {
+        out[o++] = '.';
+        for (int t = 0; t < prec; t++)
+        {
+            int i = exp10 + 1 + t;
+            out[o++] = (i >= 0 && i < len) ? d[i] : '0';
+        }
+    }
+    return o;
+}
+
+static int fmt_exp(char *out, const char *d, int len, int exp10, int prec, int upper)
+{
+    int o = 0;
+    out[o++] = len ? d[0] : '0';
+    if (prec > 0)
+    {
+        out[o++] = '.';
+        for (int i = 1; i <= prec; i++)
+        {
+            out[o++] = (i < len) ? d[i] : '0';
+        }
+    }
+
+    out[o++] = upper ? 'E' : 'e';
+    out[o++] = (exp10 < 0) ? '-' : '+';
+    int x = (exp10 < 0) ? -exp10 : exp10;
+    if (x >= 100)
+    {
+        out[o++] = (char)('0' + x / 100);
+    }
+    out[o++] = my_digit_pairs[(x % 100) * 2];
+    out[o++] = my_digit_pairs[(x % 100) * 2 + 1];
+    return o;
+}
+
+// %f %e %g: correctly rounded from the exact binary value, precision 6 when none is given
+// With the '~' flag and no precision the shortest digits that read back to v are printed instead
+static int emit_double(file_t f, double v, char conv, const FMT_SPEC *sp)
+{
+    int upper = (conv == 'F' || conv == 'E' || conv == 'G');
+    char lower = (char)(conv | 0x20);
+    char out[FLOAT_BUF_SIZE];
+    const char sign[2] = {signbit(v) ? '-' : sp->sign, '\0'};
+    int o;
+
+    if (isnan(v) || isinf(v))
+    {
+        const char *word = isnan(v) ? (upper ? "NAN" : "nan") : (upper ? "INF" : "inf");
+        FMT_SPEC plain = *sp;
+        plain.zero = 0;
+        plain.precision = -1;
+        memcpy(out,word,3);
+        return emit_padded(f,sign,out,3,&plain);
+    }
+
+    int prec = (sp->precision > FLOAT_MAX_PRECISION) ? FLOAT_MAX_PRECISION : sp->precision;
+    int shortest = sp->shortest && prec < 0;
+    if (prec < 0)
+    {
+        prec = 6;
+    }
+    int P = (prec == 0) ? 1 : prec; // %g significant digits
+
+    char d[FLOAT_BUF_SIZE];
+    int len = 0, K = 0, exp10 = 0;
+    if (v != 0.0 && shortest)
+    {
+        len = grisu2(signbit(v) ? -v : v,d,&K);
+        exp10 = len + K - 1;
+        while (len > 1 && d[len - 1] == '0')
+        {
+            len--;
+        }
+    } else if (v != 0.0)
+    {
+        // One digit past the rounding position, the sticky digit covers the rest
+        double a = signbit(v) ? -v : v;
+        if (lower == 'f')
+        {
+            len = exact_digits(a,FLOAT_BUF_SIZE,prec + 1,d,&exp10);
+        } else
+        {
+            len = exact_digits(a,((lower == 'e') ? prec + 1 : P) + 1,FLOAT_BUF_SIZE,d,&exp10);
+        }
+    }
+
+    // Shortest output keeps every digit it has and nothing more
+    if (shortest)
+    {
+        prec = (lower == 'f') ? ((len - 1 - exp10 > 0) ? len - 1 - exp10 : 0) : ((len > 1) ? len - 1 : 0);
+        P = (len > 0) ? len : 1;
+    }
+
+    if (lower == 'f')
+    {
+        len = round_digits(d,len,exp10 + 1 + prec,&exp10);
+        o = fmt_fixed(out,d,len,exp10,prec);
+    } else if (lower == 'e')
+    {
+        len = round_digits(d,len,prec + 1,&exp10);
+        if (!len)
+        {
+            exp10 = 0;
+        }
+        o = fmt_exp(out,d,len,exp10,prec,upper);
+    } else
+    {
+        len = round_digits(d,len,P,&exp10);
+        if (!len)
+        {
+            exp10 = 0;
+        }
+
+        // Trailing zeros are only printed by %#g, otherwise only the digits we have matter
+        int kept = (sp->alt) ? P : len;
+        if (exp10 >= -4 && exp10 < P)
+        {
+            int fprec = kept - 1 - exp10;
+            o = fmt_fixed(out,d,len,exp10,(fprec > 0) ? fprec : 0);
+        } else
+        {
+            o = fmt_exp(out,d,len,exp10,(kept > 1) ? kept - 1 : 0,upper);
+        }
+    }
+
+    // '#' keeps the decimal point even with no fraction digits
+    if (sp->alt && !memchr(out,'.',o))
+    {
+        const char *e = memchr(out,upper ? 'E' : 'e',o);
+        int at = (e) ? (int)(e - out) : o;
+        memmove(out + at + 1,out + at,o - at);
+        out[at] = '.';
+        o++;
+    }
+
+    return emit_padded(f,sign,out,o,sp);
+}
+
+int my_printf(file_t f, const char *fmt, ...)
+{
+    if (!f || !fmt)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    int count = 0;
+    const char *s = fmt;
+
+    va_list args;
+    va_start(args,fmt);
+    my_flockfile(f); // Once per call so records from different threads never interleave
+
+
+    while (*s)
+    {
+        if (*s != '%')
+        {
+            // Emit the whole literal run up to the next directive in one span
+            const char *run = s;
+            while (*s && *s != '%')
+            {
+                s++;
+            }
+            size_t len = s - run;
+            if (my_fwrite_unlocked(run,1,len,f) != len)
+            {
+                goto error;
+            }
+            count += len;
+            continue;
+        }
+
+        const char *directive = s;
         s++;
         if (!*s)
         {
             break;
         }
 
+        FMT_SPEC sp = {0, 0, 0, -1, 0, 0, 0, 0};
+        for (;; s++)
+        {
+            if (*s == '-') sp.left = 1;
+            else if (*s == '0') sp.zero = 1;
+            else if (*s == '~') sp.shortest = 1;
+            else if (*s == '+') sp.sign = '+';
+            else if (*s == ' ') sp.sign = (sp.sign) ? sp.sign : ' '; // '+' wins over ' '
+            else if (*s == '#') sp.alt = 1;
+            else break;
+        }
+
+        if (*s == '*')
+        {
+            sp.width = va_arg(args,int);
+            if (sp.width < 0)
+            {
+                sp.left = 1;
+                sp.width = -sp.width;
+            }
+            s++;
+        } else
+        {
+            while (*s >= '0' && *s <= '9')
+            {
+                sp.width = sp.width * 10 + (*s++ - '0');
+            }
+        }
+
+        if (*s == '.')
+        {
+            s++;
+            sp.precision = 0;
+            if (*s == '*')
+            {
+                sp.precision = va_arg(args,int);
+                if (sp.precision < 0)
+                {
+                    sp.precision = -1;
+                }
+                s++;
+            } else
+            {
+                while (*s >= '0' && *s <= '9')
+                {
+                    sp.precision = sp.precision * 10 + (*s++ - '0');
+                }
+            }
+        }
+
+        if (*s == 'l')
+        {
+            s++;
+            sp.length = 1;
+            if (*s == 'l')
+            {
+                s++;
+                sp.length = 2;
+            }
+        } else if (*s == 'z')
+        {
+            s++;
+            sp.length = 3;
+        } else if (*s == 'h')
+        {
+            s++;
+            sp.length = 4;
+            if (*s == 'h')
+            {
+                s++;
+                sp.length = 5;
+            }
+        }
+
+        int n;
         switch (*s)
         {
             case '%': 
-                if (my_putc(*s,f) < 0)
+                if (my_putc_unlocked(*s,f) < 0)
                 {
                     goto error;
                 }
-                count++;
+                n = 1;
                 break;
 
             case 'c':
             {
                 char c = (char)va_arg(args,int);
-                if (my_putc(c,f) < 0)
-                {
-                    goto error;
-                }
-                count++;
+                n = emit_str(f,&c,1,&sp);
                 break;
             }
 
@@ -337,91 +2762,300 @@ int my_printf(file_t f, const char *fmt, ...)
                 {
                     str = "NULL";
                 }   
-                while (*s)
+                size_t len;
+                if (sp.precision >= 0)
+                {
+                    const char *nul = memchr(str,'\0',sp.precision);
+                    len = nul ? (size_t)(nul - str) : (size_t)sp.precision;
+                } else
                 {
-                    if (my_putc(*str,f) < 0)
-                    {
-                        goto error;
-                    }
-                    count++;
+                    len = strlen(str);
                 }
+                n = emit_str(f,str,len,&sp);
                 break;              
             }
 
             case 'd':
+            case 'i':
             {
-                int i = va_arg(args,int);
-                char temp[32];
-                const char *str = int_to_string(i,temp);   
-                while (*str)
+                long long v;
+                switch (sp.length)
                 {
-                    if (my_putc(*str,f) < 0)
-                    {
-                        goto error;
-                    }
-                    count++;
+                    case 1: v = va_arg(args,long); break;
+                    case 2: v = va_arg(args,long long); break;
+                    case 3: v = va_arg(args,ssize_t); break;
+                    case 4: v = (short)va_arg(args,int); break; // Promoted to int, truncate back
+                    case 5: v = (signed char)va_arg(args,int); break;
+                    default: v = va_arg(args,int); break;
                 }
+                // Negate in unsigned arithmetic so LLONG_MIN/INT_MIN are safe
+                unsigned long long mag = (v < 0) ? 0ULL - (unsigned long long)v : (unsigned long long)v;
+                const char sign[2] = {(v < 0) ? '-' : sp.sign, '\0'};
+                n = emit_int(f,mag,sign,10,0,&sp);
                 break;   
+            }
+
+            case 'u':
+            case 'x':
+            case 'X':
+            {
+                unsigned long long v;
+                switch (sp.length)
+                {
+                    case 1: v = va_arg(args,unsigned long); break;
+                    case 2: v = va_arg(args,unsigned long long); break;
+                    case 3: v = va_arg(args,size_t); break;
+                    case 4: v = (unsigned short)va_arg(args,unsigned int); break;
+                    case 5: v = (unsigned char)va_arg(args,unsigned int); break;
+                    default: v = va_arg(args,unsigned int); break;
+                }
+                const char *prefix = (sp.alt && v && *s != 'u') ? ((*s == 'X') ? "0X" : "0x") : "";
+                n = emit_int(f,v,prefix,(*s == 'u') ? 10 : 16,*s == 'X',&sp);
+                break;
+            }
+
+            case 'f':
+            case 'F':
+            case 'e':
+            case 'E':
+            case 'g':
+            case 'G':
+                n = emit_double(f,va_arg(args,double),*s,&sp);
+                break;
 
+            case 'p':
+            {
+                void *ptr = va_arg(args,void*);
+                n = emit_int(f,(unsigned long long)(size_t)ptr,"0x",16,0,&sp);
+                break;
             }
 
             default:
-                if (my_putc('%', f) < 0 || my_putc(*s, f) < 0)
+            {
+                // Unknown conversion, emit the directive as written
+                if (!*s)
                 {
-                    goto error;
+                    s--;
                 }
-                count += 2;
+                size_t len = s - directive + 1;
+                n = (my_fwrite_unlocked(directive,1,len,f) == len) ? (int)len : -1;
+            }
 
         }
 
+        if (n < 0)
+        {
+            goto error;
+        }
+        count += n;
         s++;
     }
 
+    my_funlockfile(f);
     va_end(args);
     return count;
 
 error:
+    my_funlockfile(f);
     va_end(args);
     return -1;
 }
 
-char* int_to_string(int d, char *s)
+// Lock-free multi-producer log ring in front of a MY_FILE
+// Producers reserve a free slot with a compare-and-swap on head and format into it, a single drainer thread
+// copies finished records into the stream in order and writes them out in batches
+
+typedef struct LOG_SLOT
+{
+    _Alignas(64) atomic_size_t seq; // == pos when free, pos + 1 once the record is ready
+    size_t len;
+    char data[LOG_SLOT_SIZE];
+} LOG_SLOT;
+
+typedef struct MY_LOG
+{
+    file_t f;
+    LOG_SLOT *slots;
+
+    _Alignas(64) atomic_size_t head; // Next slot to reserve (producers)
+    _Alignas(64) atomic_size_t tail; // Next slot to drain (drainer)
+    atomic_size_t dropped;
+
+    atomic_int stop;
+    pthread_t drainer;
+} MY_LOG;
+
+typedef MY_LOG* log_t;
+
+// Copy every ready record into the stream and flush once, returns records drained
+// or -1 when writing them out failed (errno and the stream's err are set)
+ssize_t my_log_drain(log_t l)
+{
+    ssize_t n = 0;
+    int failed = 0;
+
+    // The stream lock serializes drainers, tail is only read and advanced under it
+    my_flockfile(l->f);
+    size_t tail = atomic_load_explicit(&l->tail,memory_order_relaxed);
+    for (;;)
+    {
+        LOG_SLOT *slot = &l->slots[tail & (LOG_RING_SLOTS - 1)];
+        if (atomic_load_explicit(&slot->seq,memory_order_acquire) != tail + 1)
+        {
+            break;
+        }
+
+        if (my_fwrite_unlocked(slot->data,1,slot->len,l->f) != slot->len)
+        {
+            failed = 1;
+        }
+        atomic_store_explicit(&slot->seq,tail + LOG_RING_SLOTS,memory_order_release);
+        tail++;
+        n++;
+    }
+    atomic_store_explicit(&l->tail,tail,memory_order_release);
+
+    if (n && flush_buffer(l->f,FLUSH_EXPLICIT) < 0)
+    {
+        failed = 1;
+    }
+    my_funlockfile(l->f);
+
+    return (failed) ? -1 : n;
+}
+
+static void *log_drainer(void *arg)
+{
+    log_t l = arg;
+    struct timespec nap = {0, 1000000}; // 1ms
+    int idle = 0;
+
+    while (!atomic_load_explicit(&l->stop,memory_order_acquire))
+    {
+        if (my_log_drain(l) != 0) // Errors stay in the stream's err for my_log_close
+        {
+            idle = 0;
+        } else if (++idle < 64) // Stay responsive while producers are active, sleep once they go quiet
+        {
+            sched_yield();
+        } else
+        {
+            nanosleep(&nap,NULL);
+        }
+    }
+
+    my_log_drain(l);
+    return NULL;
+}
+
+log_t my_log_open(file_t f)
 {
-    char* start = s;
-    int i = 0;
-    int sign = d;
+    if (!f || f->imode == READ)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    log_t l = malloc(sizeof(MY_LOG));
+    if (!l)
+    {
+        return NULL;
+    }
+    memset(l,0,sizeof(MY_LOG));
+
+    l->slots = aligned_alloc(64,sizeof(LOG_SLOT) * LOG_RING_SLOTS);
+    if (!l->slots)
+    {
+        free(l);
+        return NULL;
+    }
 
-    if ( d < 0)
+    for (size_t i = 0; i < LOG_RING_SLOTS; i++)
     {
-        d = -d;
+        atomic_init(&l->slots[i].seq,i);
     }
+    l->f = f;
 
-    if (d == 0) 
+    int rc = pthread_create(&l->drainer,NULL,log_drainer,l);
+    if (rc != 0)
     {
-        s[i++] = '0';
-        s[i] = '\0';
-        return s;
+        free(l->slots);
+        free(l);
+        errno = rc;
+        return NULL;
     }
 
-    while (d > 0)
+    return l;
+}
+
+// Never makes a syscall, records that do not fit in a full ring are dropped and counted
+// Formatting is glibc vsnprintf, so mystdio-only directives such as %~g are not available
+int my_log_printf(log_t l, const char *fmt, ...)
+{
+    if (!l || !fmt)
     {
-        s[i++] = (d % 10) + '0';
-        d /= 10;
+        errno = EINVAL;
+        return -1;
     }
 
-     if (sign < 0)
+    // Claim the slot at head only while it is free (seq == pos), a slot still holding an older record means the ring is full
+    size_t pos = atomic_load_explicit(&l->head,memory_order_relaxed);
+    LOG_SLOT *slot;
+    for (;;)
     {
-        s[i++] = '-';
+        slot = &l->slots[pos & (LOG_RING_SLOTS - 1)];
+        intptr_t diff = (intptr_t)atomic_load_explicit(&slot->seq,memory_order_acquire) - (intptr_t)pos;
+        if (diff == 0)
+        {
+            if (atomic_compare_exchange_weak_explicit(&l->head,&pos,pos + 1,memory_order_relaxed,memory_order_relaxed))
+            {
+                break;
+            }
+        } else if (diff < 0)
+        {
+            atomic_fetch_add_explicit(&l->dropped,1,memory_order_relaxed);
+            errno = EAGAIN;
+            return -1;
+        } else
+        {
+            pos = atomic_load_explicit(&l->head,memory_order_relaxed); // Another producer took this slot
+        }
     }
 
-    s[i] = '\0';
+    va_list args;
+    va_start(args,fmt);
+    int n = vsnprintf(slot->data,LOG_SLOT_SIZE,fmt,args);
+    va_end(args);
+
+    // The slot is past head and must still reach the drainer in order, a failed format
+    // releases it empty so no partial record is written
+    size_t len = (n < 0) ? 0 : ((size_t)n < LOG_SLOT_SIZE) ? (size_t)n : LOG_SLOT_SIZE - 1;
+    slot->len = len;
+
+    // The drainer may recycle the slot as soon as it is published, slot is not touched after this
+    atomic_store_explicit(&slot->seq,pos + 1,memory_order_release);
+    return (n < 0) ? -1 : (int)len;
+}
+
+size_t my_log_dropped(log_t l)
+{
+    return atomic_load_explicit(&l->dropped,memory_order_relaxed);
+}
 
-    for (int j = 0, k = i - 1; j < k; j++, k--)
+// Stop the drainer after it empties the ring, the underlying stream is left open
+int my_log_close(log_t l)
+{
+    if (!l)
     {
-        char temp = s[j];
-        s[j] = s[k];
-        s[k] = temp;
+        errno = EINVAL;
+        return -1;
     }
 
-    return start;
+    atomic_store_explicit(&l->stop,1,memory_order_release);
+    pthread_join(l->drainer,NULL);
+
+    int res = (l->f->err) ? -1 : 0;
+    free(l->slots);
+    free(l);
+    return res;
 }
\ No newline at end of file
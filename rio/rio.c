@@ -1,15 +1,85 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // copy_file_range, splice
+#endif
 #include <errno.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stddef.h>
 #include <string.h>
+#include <sys/mman.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+#include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
 #include <unistd.h>
 
 #define BUFFER_SIZE 0x1000 // 4096 bytes
+// Read-only regular files at least this big are mapped instead of read, open with RIO_NOMMAP to opt out
+// Hazard: truncating the file while a window is mapped raises SIGBUS on the next access past the new end,
+// use RIO_NOMMAP for files other processes may shrink. Growth is picked up when the reader reaches the old end
+#define RIO_MMAP_THRESHOLD (1 << 20)
+#define RIO_MMAP_WINDOW ((size_t)64 << 20) // Most of a file mapped at once, larger files are remapped window by window
+#define RIO_MMAP 0x40000000 // rio_open flag: map the file whatever its size (read-only regular files only)
+#define RIO_NOMMAP 0x20000000 // rio_open flag: never map, always read through rbuf
+#define RIO_PAGE_SIZE 0x1000 // Page cache granularity
+#define RIO_PCACHE_STRIPES 16 // Locks guarding the page cache, slot i uses lock i % RIO_PCACHE_STRIPES
+#define RIO_PCACHE_BYPASS (64 * RIO_PAGE_SIZE) // Positional reads at least this big skip the page cache
+#ifdef IOV_MAX
+#define RIO_IOV_BATCH IOV_MAX // iovecs handed to one readv/writev call, the most the kernel accepts
+#else
+#define RIO_IOV_BATCH 1024
+#endif
+#define RIO_COPY_CHUNK ((size_t)1 << 20) // Most bytes moved by one kernel copy call or fallback read/write
+#define RIO_STATS_BUCKETS 24 // Latency buckets: < 1us, then one per power of two up to ~4s
 typedef struct fdata *rio_t; // Opaque type
 
+// Why the write buffer was written out
+enum
+{
+    RIO_FLUSH_FULL,
+    RIO_FLUSH_EXPLICIT, // rio_flush, or an unbuffered write or read after buffered writes
+    RIO_FLUSH_SEEK,
+    RIO_FLUSH_CLOSE,
+    RIO_FLUSH_CAUSES
+};
+
+// I/O counters, only maintained when built with -DRIO_STATS
+struct rio_stats
+{
+    unsigned long long bytes_read;
+    unsigned long long bytes_written;
+    unsigned long long read_calls;
+    unsigned long long write_calls;
+    unsigned long long short_writes;
+    unsigned long long eintr_retries;
+    unsigned long long flushes[RIO_FLUSH_CAUSES]; // Write buffer flushes, indexed by RIO_FLUSH_*
+    unsigned long long latency[RIO_STATS_BUCKETS]; // Per read/write syscall, bucket 0: < 1us, bucket i: [2^(i-1), 2^i) us
+};
+
+// One cached page of the file, len < RIO_PAGE_SIZE means the file ends inside it
+struct rio_page
+{
+    off_t page_no; // -1 when the slot is empty
+    size_t len;
+    char data[RIO_PAGE_SIZE];
+};
+
+// Direct-mapped page cache shared by the positional reads on one file
+struct rio_pcache
+{
+    size_t npages;
+    struct rio_page *pages;
+    unsigned long epoch; // Bumped by every invalidation, a page read across one is not installed
+    off_t eof_page; // Last page cached short because the file ended in it, -1 when none
+    pthread_mutex_t locks[RIO_PCACHE_STRIPES];
+};
+
 // File metadata + for internal buffer
 struct fdata
 {
@@ -17,8 +87,365 @@ struct fdata
     char rbuf[BUFFER_SIZE];
     size_t cursor_pos;
     size_t unread_bytes;
+    char *base; // Buffer cursor_pos/unread_bytes index, rbuf or the current mmap window
+    int mmapped; // Reads are served from a mapping of the file instead of read()
+    char *map; // Current window, NULL when nothing is mapped
+    size_t map_len;
+    off_t map_off; // File offset of the window, page aligned
+    off_t file_size; // Size when the current window was mapped, re-read before reporting EOF
+    char wbuf[BUFFER_SIZE]; // Small rio_writeb writes are coalesced here
+    size_t wbuf_len;
+    struct rio_pcache *pcache; // Optional cache for rio_preadn, see rio_enable_pcache
+    off_t fd_off; // Kernel file offset, rbuf holds the bytes just before it, -1 when unknown
+    int seekable;
+    int append; // O_APPEND writes move the offset to the end, so fd_off is lost after them
+#ifdef RIO_STATS
+    struct rio_stats stats;
+#endif
 };
 
+#ifdef RIO_STATS
+// Relaxed atomics, positional calls update the counters from many threads
+#define RIO_STAT(finfo,field,n) __atomic_fetch_add(&(finfo)->stats.field,(unsigned long long)(n),__ATOMIC_RELAXED)
+
+static unsigned long long rio_clock(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * Count one read/write syscall asking for n bytes that returned res, and file its latency since t0
+ * into a log2 microsecond bucket
+ */
+static void rio_stat_io(rio_t finfo, int is_write, size_t n, ssize_t res, unsigned long long t0)
+{
+    unsigned long long us = (rio_clock() - t0) / 1000;
+    int b = (us == 0) ? 0 : 64 - __builtin_clzll(us);
+    if (b >= RIO_STATS_BUCKETS)
+    {
+        b = RIO_STATS_BUCKETS - 1;
+    }
+    RIO_STAT(finfo,latency[b],1);
+
+    if (is_write)
+    {
+        RIO_STAT(finfo,write_calls,1);
+        if (res > 0)
+        {
+            RIO_STAT(finfo,bytes_written,res);
+            if ((size_t)res < n)
+            {
+                RIO_STAT(finfo,short_writes,1);
+            }
+        }
+    } else
+    {
+        RIO_STAT(finfo,read_calls,1);
+        if (res > 0)
+        {
+            RIO_STAT(finfo,bytes_read,res);
+        }
+    }
+
+    if (res < 0 && errno == EINTR)
+    {
+        RIO_STAT(finfo,eintr_retries,1);
+    }
+}
+
+#define RIO_CLOCK_START unsigned long long t0 = rio_clock()
+#define RIO_STAT_IO(finfo,is_write,n,res) rio_stat_io(finfo,is_write,n,res,t0)
+#else
+#define RIO_STAT(finfo,field,n) ((void)0)
+#define RIO_CLOCK_START ((void)0)
+#define RIO_STAT_IO(finfo,is_write,n,res) ((void)0)
+#endif
+
+/**
+ * Slot of page pno, pages are spread over the slots by a multiplicative hash
+ */
+static size_t rio_pcache_slot(const struct rio_pcache *pc, off_t pno)
+{
+    return (size_t)(((unsigned long long)pno * 0x9E3779B97F4A7C15ULL) >> 32) % pc->npages;
+}
+
+/**
+ * Drop page pno if it is cached
+ */
+static void rio_pcache_drop(struct rio_pcache *pc, off_t pno)
+{
+    size_t slot = rio_pcache_slot(pc,pno);
+    pthread_mutex_t *lock = &pc->locks[slot % RIO_PCACHE_STRIPES];
+    pthread_mutex_lock(lock);
+    if (pc->pages[slot].page_no == pno)
+    {
+        pc->pages[slot].page_no = -1;
+    }
+    pthread_mutex_unlock(lock);
+}
+
+/**
+ * Drop cached pages overlapping [offset, offset + len), len 0 drops every page
+ * The short page the file ended in goes too when it lies before the range: a write past the end fills the gap
+ * with zeros that page does not have
+ */
+static void rio_pcache_invalidate(struct rio_pcache *pc, off_t offset, size_t len)
+{
+    __atomic_fetch_add(&pc->epoch,1,__ATOMIC_SEQ_CST);
+    off_t first = offset / RIO_PAGE_SIZE;
+    off_t last = (offset + (off_t)len - 1) / RIO_PAGE_SIZE;
+
+    // Ranges no larger than the cache only look at the slots their pages hash to
+    if (len && (size_t)(last - first) < pc->npages)
+    {
+        off_t eof = __atomic_load_n(&pc->eof_page,__ATOMIC_SEQ_CST);
+        if (eof >= 0 && eof < first)
+        {
+            rio_pcache_drop(pc,eof);
+        }
+        for (off_t pno = first; pno <= last; pno++)
+        {
+            rio_pcache_drop(pc,pno);
+        }
+        return;
+    }
+
+    for (size_t i = 0; i < pc->npages; i++)
+    {
+        pthread_mutex_t *lock = &pc->locks[i % RIO_PCACHE_STRIPES];
+        pthread_mutex_lock(lock);
+        struct rio_page *pg = &pc->pages[i];
+        if (pg->page_no >= 0 && (len == 0 || (pg->page_no <= last && pg->page_no >= first) ||
+                                 (pg->page_no < first && pg->len < RIO_PAGE_SIZE)))
+        {
+            pg->page_no = -1;
+        }
+        pthread_mutex_unlock(lock);
+    }
+}
+
+/**
+ * n bytes were just written through the file offset: drop the pages they landed on, or every page when the
+ * offset is unknown (O_APPEND moved it to the end)
+ */
+static void rio_pcache_written(rio_t finfo, size_t n)
+{
+    if (!finfo->pcache)
+    {
+        return;
+    }
+    if (finfo->fd_off >= 0)
+    {
+        rio_pcache_invalidate(finfo->pcache,finfo->fd_off - (off_t)n,n);
+    } else
+    {
+        rio_pcache_invalidate(finfo->pcache,0,0);
+    }
+}
+
+/**
+ * The file offset moved without rbuf following it: forget the buffered window so rio_seek cannot land inside it
+ * Pipes and sockets read and write independently, their read buffer is kept
+ */
+static void rio_window_reset(rio_t finfo)
+{
+    if (finfo->seekable && !finfo->mmapped)
+    {
+        finfo->cursor_pos = 0;
+        finfo->unread_bytes = 0;
+    }
+}
+
+/**
+ * read() on the file, counted and timed when stats are enabled
+ */
+static ssize_t rio_sys_read(rio_t finfo, void *buf, size_t n)
+{
+    RIO_CLOCK_START;
+    ssize_t r = read(finfo->fd,buf,n);
+    RIO_STAT_IO(finfo,0,n,r);
+    if (r > 0 && finfo->fd_off >= 0)
+    {
+        finfo->fd_off += r;
+    }
+    return r;
+}
+
+/**
+ * write() on the file, counted and timed when stats are enabled
+ */
+static ssize_t rio_sys_write(rio_t finfo, const void *buf, size_t n)
+{
+    RIO_CLOCK_START;
+    ssize_t w = write(finfo->fd,buf,n);
+    RIO_STAT_IO(finfo,1,n,w);
+    if (w > 0)
+    {
+        if (finfo->fd_off >= 0)
+        {
+            finfo->fd_off = (finfo->append) ? -1 : finfo->fd_off + w;
+        }
+        rio_window_reset(finfo);
+        rio_pcache_written(finfo,w);
+    }
+    return w;
+}
+
+#ifdef RIO_STATS
+/**
+ * Sum of the lengths of cnt iovecs
+ */
+static size_t rio_iov_len(const struct iovec *iov, int cnt)
+{
+    size_t n = 0;
+    for (int i = 0; i < cnt; i++)
+    {
+        n += iov[i].iov_len;
+    }
+    return n;
+}
+#endif
+
+/**
+ * readv() on the file, counted and timed when stats are enabled
+ */
+static ssize_t rio_sys_readv(rio_t finfo, const struct iovec *iov, int cnt)
+{
+    RIO_CLOCK_START;
+    ssize_t r = readv(finfo->fd,iov,cnt);
+    RIO_STAT_IO(finfo,0,rio_iov_len(iov,cnt),r);
+    if (r > 0 && finfo->fd_off >= 0)
+    {
+        finfo->fd_off += r;
+    }
+    return r;
+}
+
+/**
+ * writev() on the file, counted and timed when stats are enabled
+ */
+static ssize_t rio_sys_writev(rio_t finfo, const struct iovec *iov, int cnt)
+{
+    RIO_CLOCK_START;
+    ssize_t w = writev(finfo->fd,iov,cnt);
+    RIO_STAT_IO(finfo,1,rio_iov_len(iov,cnt),w);
+    if (w > 0)
+    {
+        if (finfo->fd_off >= 0)
+        {
+            finfo->fd_off = (finfo->append) ? -1 : finfo->fd_off + w;
+        }
+        rio_window_reset(finfo);
+        rio_pcache_written(finfo,w);
+    }
+    return w;
+}
+
+/**
+ * Step past n transferred bytes: fully done iovecs are skipped and the one stopped in is trimmed
+ */
+static void rio_iov_advance(struct iovec **iov, int *cnt, size_t n)
+{
+    while (*cnt > 0 && n >= (*iov)->iov_len)
+    {
+        n -= (*iov)->iov_len;
+        (*iov)++;
+        (*cnt)--;
+    }
+    if (*cnt > 0)
+    {
+        (*iov)->iov_base = (char *)(*iov)->iov_base + n;
+        (*iov)->iov_len -= n;
+    }
+}
+
+/**
+ * pread() on the file, counted and timed when stats are enabled
+ */
+static ssize_t rio_sys_pread(rio_t finfo, void *buf, size_t n, off_t offset)
+{
+    RIO_CLOCK_START;
+    ssize_t r = pread(finfo->fd,buf,n,offset);
+    RIO_STAT_IO(finfo,0,n,r);
+    return r;
+}
+
+/**
+ * pwrite() on the file, counted and timed when stats are enabled
+ */
+static ssize_t rio_sys_pwrite(rio_t finfo, const void *buf, size_t n, off_t offset)
+{
+    RIO_CLOCK_START;
+    ssize_t w = pwrite(finfo->fd,buf,n,offset);
+    RIO_STAT_IO(finfo,1,n,w);
+    return w;
+}
+
+int rio_enable_pcache(rio_t finfo, size_t pages);
+
+/**
+ * Write out the coalesced bytes of rio_writeb
+ * On a failed write the unwritten bytes stay buffered, so the flush can be retried
+ * Returns 0 on success, -1 on error
+ */
+static int rio_flush_cause(rio_t finfo, int cause)
+{
+    size_t done = 0;
+    while (done < finfo->wbuf_len)
+    {
+        ssize_t w = rio_sys_write(finfo, finfo->wbuf + done, finfo->wbuf_len - done);
+        if (w < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            perror("write");
+            break;
+        }
+        if (w == 0)
+        {
+            break;
+        }
+        done += w;
+    }
+
+    if (done < finfo->wbuf_len)
+    {
+        memmove(finfo->wbuf, finfo->wbuf + done, finfo->wbuf_len - done);
+        finfo->wbuf_len -= done;
+        return -1;
+    }
+
+    finfo->wbuf_len = 0;
+    RIO_STAT(finfo,flushes[cause],1);
+    (void)cause;
+    return 0;
+}
+
+/**
+ * Get ready to write at the logical position: read-ahead in rbuf is dropped and the file offset wound back over it
+ * Pipes and sockets read and write independently, their read buffer is kept
+ */
+static void rio_drop_readahead(rio_t finfo)
+{
+    if (finfo->mmapped || finfo->unread_bytes == 0)
+    {
+        return;
+    }
+
+    off_t res = lseek(finfo->fd, -(off_t)finfo->unread_bytes, SEEK_CUR);
+    if (res < 0)
+    {
+        return;
+    }
+    finfo->fd_off = res;
+    finfo->cursor_pos = 0;
+    finfo->unread_bytes = 0;
+}
+
 /**
  * Open requested file using system open call 
  * To open process std file streams use:
@@ -27,239 +454,1340 @@ struct fdata
  * "/dev/stderr" -> standard error
  * Returns rio_t struct which has file data information
  */
-rio_t rio_open(const char *pathname, int flags, mode_t mode)
+rio_t rio_open(const char *pathname, int flags, mode_t mode)
+{
+    rio_t finfo = malloc(sizeof(struct fdata));
+    int df;
+    if (!finfo)
+    {
+        perror("malloc");
+        return NULL;
+    }
+    memset(finfo,0,sizeof(struct fdata)); // zero out for safety
+    finfo->base = finfo->rbuf;
+
+    int want_map = (flags & RIO_MMAP) != 0;
+    int no_map = (flags & RIO_NOMMAP) != 0;
+    flags &= ~(RIO_MMAP | RIO_NOMMAP);
+
+    if (flags & O_CREAT)
+    {
+        df = open(pathname,flags,mode);
+        if (df < 0)
+        {
+            perror("open");
+            free(finfo);
+            return NULL;
+        }
+        finfo->fd = df;
+    } else
+    {
+        df = open(pathname,flags,0);
+        if (df < 0)
+        {
+            perror("open");
+            free(finfo);
+            return NULL;
+        }
+        finfo->fd = df;
+    }
+
+    // Pipes and sockets fail here and keep fd_off at -1
+    finfo->fd_off = lseek(df,0,SEEK_CUR);
+    finfo->seekable = finfo->fd_off >= 0;
+    finfo->append = (flags & O_APPEND) != 0;
+
+    // Large read-only regular files are served from a mapping, the first window is mapped on the first read
+    struct stat st;
+    if (!no_map && (flags & O_ACCMODE) == O_RDONLY && fstat(df,&st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0 &&
+        (want_map || st.st_size >= RIO_MMAP_THRESHOLD))
+    {
+        finfo->mmapped = 1;
+        finfo->file_size = st.st_size;
+    }
+    return finfo;
+}
+
+/**
+ * Map the window of the file that holds offset pos and point the cursor at pos
+ * Returns bytes available from pos, 0 at or past the end of the file, -1 on error
+ */
+static ssize_t rio_map_window(rio_t finfo, off_t pos)
+{
+    if (finfo->map)
+    {
+        munmap(finfo->map,finfo->map_len);
+        finfo->map = NULL;
+        finfo->map_len = 0;
+    }
+    finfo->base = finfo->rbuf;
+    finfo->map_off = pos;
+    finfo->cursor_pos = 0;
+    finfo->unread_bytes = 0;
+
+    // The file may have grown or shrunk since it was opened, never map past its current end
+    struct stat st;
+    if (fstat(finfo->fd,&st) == 0)
+    {
+        finfo->file_size = st.st_size;
+    }
+    if (pos >= finfo->file_size)
+    {
+        return 0;
+    }
+
+    off_t start = pos & ~((off_t)sysconf(_SC_PAGESIZE) - 1);
+    size_t len = (finfo->file_size - start < (off_t)RIO_MMAP_WINDOW) ? (size_t)(finfo->file_size - start) : RIO_MMAP_WINDOW;
+    char *m = mmap(NULL,len,PROT_READ,MAP_PRIVATE,finfo->fd,start);
+    if (m == MAP_FAILED)
+    {
+        perror("mmap");
+        return -1;
+    }
+
+    // Read-ahead hints: the window is consumed front to back and should be paged in early
+    madvise(m,len,MADV_SEQUENTIAL);
+    madvise(m,len,MADV_WILLNEED);
+
+    finfo->map = m;
+    finfo->map_len = len;
+    finfo->map_off = start;
+    finfo->base = m;
+    finfo->cursor_pos = pos - start;
+    finfo->unread_bytes = len - finfo->cursor_pos;
+    return finfo->unread_bytes;
+}
+
+/**
+ * Close file by passing rio_t struct that has file metadata
+ * Buffered writes are flushed first
+ * If file is not closed, struct is intact and can be used to retry operation
+ */
+void rio_close(rio_t finfo)
+{
+    if (!finfo)
+    {
+        return;
+
+    }
+    if (finfo->wbuf_len)
+    {
+        rio_flush_cause(finfo, RIO_FLUSH_CLOSE); // On failure the buffered bytes are lost with the file
+    }
+
+    int df = finfo->fd;
+    int c = close(df);
+    if (c < 0)
+    {
+        perror("close");
+        return;
+    }
+
+    if (finfo->map)
+    {
+        munmap(finfo->map,finfo->map_len);
+    }
+
+    rio_enable_pcache(finfo,0);
+    free(finfo);
+
+}
+
+/**
+ * Move read/write file pointer by specfic offset by using relative postion using lseek
+ * Buffered writes are flushed first, SEEK_SET/SEEK_CUR targets inside the read buffer keep it and make no syscall
+ * Returns offset from start.
+ */
+off_t rio_seek(rio_t finfo, off_t offset, int whence)
+{
+    if (!finfo)
+    {
+        return (off_t)-1;
+    }
+
+    if (finfo->wbuf_len && rio_flush_cause(finfo, RIO_FLUSH_SEEK) < 0)
+    {
+        return (off_t)-1;
+    }
+
+    // Mapped files seek by moving the cursor, leaving the window only drops the mapping
+    if (finfo->mmapped)
+    {
+        off_t cur = finfo->map_off + (off_t)finfo->cursor_pos;
+        struct stat st;
+        if (whence == SEEK_END && fstat(finfo->fd,&st) == 0)
+        {
+            finfo->file_size = st.st_size; // The end as it is now, not as it was mapped
+        }
+
+        off_t target;
+        switch (whence)
+        {
+            case SEEK_SET: target = offset; break;
+            case SEEK_CUR: target = cur + offset; break;
+            case SEEK_END: target = finfo->file_size + offset; break;
+            default: target = -1; break;
+        }
+        if (target < 0)
+        {
+            errno = EINVAL;
+            perror("seek");
+            return (off_t)-1;
+        }
+
+        if (finfo->map && target >= finfo->map_off && target <= finfo->map_off + (off_t)finfo->map_len)
+        {
+            finfo->cursor_pos = target - finfo->map_off;
+            finfo->unread_bytes = finfo->map_len - finfo->cursor_pos;
+        } else
+        {
+            // Unmap only, the next read maps the window at target
+            if (finfo->map)
+            {
+                munmap(finfo->map,finfo->map_len);
+                finfo->map = NULL;
+                finfo->map_len = 0;
+            }
+            finfo->base = finfo->rbuf;
+            finfo->cursor_pos = 0;
+            finfo->unread_bytes = 0;
+            finfo->map_off = target;
+        }
+        return target;
+    }
+
+    // Targets inside the buffered window [fd_off - cursor_pos - unread_bytes, fd_off] only move the cursor
+    if (finfo->fd_off >= 0 && (whence == SEEK_SET || whence == SEEK_CUR))
+    {
+        off_t target = (whence == SEEK_SET) ? offset : finfo->fd_off - (off_t)finfo->unread_bytes + offset;
+        off_t window = finfo->fd_off - (off_t)(finfo->cursor_pos + finfo->unread_bytes);
+        if (target >= window && target <= finfo->fd_off)
+        {
+            finfo->cursor_pos = target - window;
+            finfo->unread_bytes = finfo->fd_off - target;
+            return target;
+        }
+        offset = target;
+        whence = SEEK_SET;
+    } else if (whence == SEEK_CUR)
+    {
+        offset -= (off_t)finfo->unread_bytes; // The kernel offset is ahead of the reader by the unread bytes
+    }
+
+    off_t res = lseek(finfo->fd,offset,whence);
+    if (res < 0)
+    {
+        perror("seek");
+        return (off_t)-1;
+    }
+
+    finfo->fd_off = res;
+    finfo->cursor_pos = 0;
+    finfo->unread_bytes = 0;
+    return res;
+
+}
+
+/**
+ * Print state of buffer for debugging
+ */
+void rio_dump_state(rio_t finfo)
+{
+    if (!finfo)
+    {
+        puts("No file metadata found.");
+        return;
+    }
+
+    puts("--- File Information ---");
+    printf("File descriptor: %d\n", finfo->fd);
+    printf("Current buffer position: %zu\n", finfo->cursor_pos);
+    printf("Unread bytes left in buffer: %zu\n", finfo->unread_bytes);
+    printf("Buffered bytes waiting to be written: %zu\n", finfo->wbuf_len);
+    if (finfo->mmapped)
+    {
+        printf("Mapped window: offset %lld, %zu bytes of %lld\n", (long long)finfo->map_off, finfo->map_len,
+               (long long)finfo->file_size);
+    }
+
+#ifdef RIO_STATS
+    const struct rio_stats *st = &finfo->stats;
+    puts("--- I/O Statistics ---");
+    printf("Bytes read: %llu in %llu read calls\n", st->bytes_read, st->read_calls);
+    printf("Bytes written: %llu in %llu write calls (%llu short)\n", st->bytes_written, st->write_calls, st->short_writes);
+    printf("EINTR retries: %llu\n", st->eintr_retries);
+    printf("Write buffer flushes: %llu full, %llu explicit, %llu seek, %llu close\n", st->flushes[RIO_FLUSH_FULL],
+           st->flushes[RIO_FLUSH_EXPLICIT], st->flushes[RIO_FLUSH_SEEK], st->flushes[RIO_FLUSH_CLOSE]);
+    puts("Syscall latency:");
+    for (int i = 0; i < RIO_STATS_BUCKETS; i++)
+    {
+        if (!st->latency[i])
+        {
+            continue;
+        }
+        if (i == 0)
+        {
+            printf("  < 1us: %llu\n", st->latency[i]);
+        } else
+        {
+            printf("  %llu-%lluus: %llu\n", 1ULL << (i - 1), 1ULL << i, st->latency[i]);
+        }
+    }
+#endif
+}
+
+/**
+ * Copy the I/O counters of the file into out
+ * Returns -1 with errno ENOTSUP unless built with -DRIO_STATS
+ */
+int rio_stats(rio_t finfo, struct rio_stats *out)
+{
+    if (!finfo || !out)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    memset(out,0,sizeof(*out));
+#ifdef RIO_STATS
+    // Other threads may be adding to the counters, load each one atomically
+    const unsigned long long *src = (const unsigned long long *)&finfo->stats;
+    unsigned long long *dst = (unsigned long long *)out;
+    for (size_t i = 0; i < sizeof(*out) / sizeof(*dst); i++)
+    {
+        dst[i] = __atomic_load_n(&src[i],__ATOMIC_RELAXED);
+    }
+    return 0;
+#else
+    errno = ENOTSUP;
+    return -1;
+#endif
+}
+
+/**
+ * Read bytes requested into user buffer (user must make sure buffer is big enough to handle request)
+ * This function guarantees all of bytes requested will be read unless an devastating error occurs, fewer on (EOF)
+ */
+ssize_t rio_readn(rio_t finfo, void *usr_buf, size_t bytes_to_read)
+{
+    if (!finfo || !usr_buf)
+    {
+        return -1;
+    }
+
+    if (finfo->wbuf_len && rio_flush_cause(finfo, RIO_FLUSH_EXPLICIT) < 0) // Reads see earlier buffered writes
+    {
+        return -1;
+    }
+
+    char *ub = (char *)(usr_buf);
+    size_t total_read = 0;
+
+    // Mapped files copy straight out of the mapping, window by window
+    if (finfo->mmapped)
+    {
+        while (total_read < bytes_to_read)
+        {
+            if (finfo->unread_bytes == 0)
+            {
+                ssize_t res = rio_map_window(finfo,finfo->map_off + (off_t)finfo->cursor_pos);
+                if (res < 0)
+                {
+                    return -1;
+                }
+                if (res == 0) // EOF
+                {
+                    break;
+                }
+            }
+
+            size_t chunk = (finfo->unread_bytes < bytes_to_read - total_read) ? finfo->unread_bytes : bytes_to_read - total_read;
+            memcpy(ub + total_read,finfo->base + finfo->cursor_pos,chunk);
+            finfo->cursor_pos += chunk;
+            finfo->unread_bytes -= chunk;
+            total_read += chunk;
+        }
+        return total_read;
+    }
+
+    if (bytes_to_read)
+    {
+        rio_window_reset(finfo); // Reading past rbuf, it no longer sits just before the file offset
+    }
+
+    while(total_read < bytes_to_read)
+    {
+        ssize_t itr_read = rio_sys_read(finfo, ub + total_read, bytes_to_read - total_read);
+        if (itr_read < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            perror("read");
+            return -1;
+        }
+
+        if (itr_read == 0) // EOF
+        {
+            break;
+        } 
+
+        total_read += itr_read;
+    }
+
+    return total_read;
+}
+
+/**
+ * Write bytes from user buffer (user must make sure buffer is big enough to handle request)
+ * This function guarantees all of bytes requested will be wrote unless an devasting error occurs
+ */
+ssize_t rio_writen(rio_t finfo, const void *usr_buf, size_t bytes_to_write)
+{
+    if (!finfo || !usr_buf)
+    {
+        return -1;
+    }
+
+    // Keep the byte order of earlier buffered writes and write where reading left off
+    if (finfo->wbuf_len && rio_flush_cause(finfo, RIO_FLUSH_EXPLICIT) < 0)
+    {
+        return -1;
+    }
+    rio_drop_readahead(finfo);
+
+    const char *ub = (char *)(usr_buf);
+    size_t total_wrote = 0;
+    while(total_wrote < bytes_to_write)
+    {
+        ssize_t itr_wrote = rio_sys_write(finfo, ub + total_wrote, bytes_to_write - total_wrote);
+        if (itr_wrote < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            perror("write");
+            return -1;
+        }
+
+        if (itr_wrote == 0) // Abnormal behaviour, exit with error
+        {
+            return -1;
+        }
+        total_wrote += itr_wrote;
+    }
+
+    return total_wrote;
+
+}
+
+/**
+ * Refill the internal buffer with one read, only call when it has no unread bytes
+ * Returns bytes read, 0 on EOF, -1 on error
+ */
+static ssize_t rio_fill(rio_t finfo)
+{
+    if (finfo->mmapped)
+    {
+        return rio_map_window(finfo,finfo->map_off + (off_t)finfo->cursor_pos);
+    }
+
+    ssize_t res;
+    do
+    {
+        res = rio_sys_read(finfo, finfo->rbuf, BUFFER_SIZE);
+    } while (res < 0 && errno == EINTR);
+
+    if (res < 0)
+    {
+        perror("read");
+        return -1;
+    }
+
+    finfo->unread_bytes = res;
+    finfo->cursor_pos = 0;
+    return res;
+}
+
+/**
+ * Attempt to read bytes from file and put fill user buffer (use internal buffer when buffer size is respectable w.r.t to constraint)
+ * If request is to big, handle it with readn()
+ *  Return up to N bytes with minimal syscalls, handling partial reads correctly
+ */
+ssize_t rio_read(rio_t finfo, void *usr_buf, size_t bytes_to_read)
+{
+    if (!finfo || !usr_buf)
+    {
+        return -1;
+    }
+
+    if (finfo->wbuf_len && rio_flush_cause(finfo, RIO_FLUSH_EXPLICIT) < 0) // Reads see earlier buffered writes
+    {
+        return -1;
+    }
+
+    char *ub = (char *)(usr_buf);
+    ssize_t res;
+    if (bytes_to_read > BUFFER_SIZE && !finfo->mmapped)
+    {
+        size_t buffered_bytes = (finfo->unread_bytes > bytes_to_read) ? bytes_to_read : finfo->unread_bytes;
+        if (buffered_bytes)
+        {
+            memcpy(ub,finfo->rbuf + finfo->cursor_pos,buffered_bytes);
+            ub += buffered_bytes;
+            bytes_to_read -= buffered_bytes;
+            finfo->unread_bytes = 0;
+            finfo->cursor_pos = 0;
+        }
+
+        res = rio_readn(finfo,ub,bytes_to_read);
+        if (res < 0)
+        {
+            return -1;
+        }
+        return (res + buffered_bytes);
+    }
+
+    // Read into internal buffer
+    if (finfo->unread_bytes == 0)
+    {
+        res = rio_fill(finfo);
+        if (res <= 0)
+        {
+            return res;
+        }
+    }
+
+    ssize_t bytes_read = (finfo->unread_bytes > bytes_to_read) ? bytes_to_read : finfo->unread_bytes;
+    memcpy(usr_buf,finfo->base + finfo->cursor_pos,bytes_read);
+    finfo->cursor_pos += bytes_read;
+    finfo->unread_bytes -= bytes_read;
+
+    return bytes_read;
+}
+
+/**
+ * Read up to and including delim into user buffer and NUL terminate it
+ * At most maxlen - 1 bytes are stored, a longer record is returned in pieces
+ * The unread window is searched with memchr and every byte is copied once, so records that span refills stay linear
+ * Returns bytes stored (without the NUL), 0 on EOF before any byte, -1 on error
+ */
+ssize_t rio_read_until(rio_t finfo, void *usr_buf, size_t maxlen, int delim)
+{
+    if (!finfo || !usr_buf || maxlen == 0)
+    {
+        return -1;
+    }
+
+    if (finfo->wbuf_len && rio_flush_cause(finfo, RIO_FLUSH_EXPLICIT) < 0) // Reads see earlier buffered writes
+    {
+        return -1;
+    }
+
+    char *ub = (char *)(usr_buf);
+    size_t room = maxlen - 1;
+    size_t total = 0;
+    while (total < room)
+    {
+        if (finfo->unread_bytes == 0)
+        {
+            ssize_t res = rio_fill(finfo);
+            if (res < 0)
+            {
+                return -1;
+            }
+            if (res == 0) // EOF, return what we have
+            {
+                break;
+            }
+        }
+
+        const char *start = finfo->base + finfo->cursor_pos;
+        size_t window = (finfo->unread_bytes < room - total) ? finfo->unread_bytes : room - total;
+        const char *hit = memchr(start, delim, window);
+        size_t chunk = (hit) ? (size_t)(hit - start) + 1 : window;
+
+        memcpy(ub + total, start, chunk);
+        finfo->cursor_pos += chunk;
+        finfo->unread_bytes -= chunk;
+        total += chunk;
+
+        if (hit)
+        {
+            break;
+        }
+    }
+
+    ub[total] = '\0';
+    return total;
+}
+
+/**
+ * Read one text line, including its '\n', into user buffer, see rio_read_until
+ */
+ssize_t rio_readlineb(rio_t finfo, void *usr_buf, size_t maxlen)
+{
+    return rio_read_until(finfo, usr_buf, maxlen, '\n');
+}
+
+/**
+ * Expose at least min unread bytes in place without copying them out
+ * *ptr points at the unread bytes inside the internal buffer, *avail is how many there are
+ * The unread tail is moved to the front of the buffer before refilling, so min may be up to BUFFER_SIZE
+ * Mapped files return a pointer into the mapping
+ * At EOF *avail can be less than min (0 once everything is consumed)
+ * The pointer is valid until the next call on finfo, call rio_consume to move past parsed bytes
+ * Returns 0 on success, -1 on error
+ */
+int rio_peek(rio_t finfo, size_t min, const char **ptr, size_t *avail)
+{
+    if (!finfo || !ptr || !avail || min > BUFFER_SIZE)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (finfo->wbuf_len && rio_flush_cause(finfo, RIO_FLUSH_EXPLICIT) < 0) // Reads see earlier buffered writes
+    {
+        return -1;
+    }
+
+    if (finfo->mmapped)
+    {
+        // Remap so the window starts at the cursor when min bytes would run past its end
+        off_t pos = finfo->map_off + (off_t)finfo->cursor_pos;
+        if (finfo->unread_bytes < min && rio_map_window(finfo,pos) < 0)
+        {
+            return -1;
+        }
+    } else if (finfo->unread_bytes < min)
+    {
+        // Compact so the refill has room behind the unread tail
+        if (finfo->cursor_pos)
+        {
+            memmove(finfo->rbuf, finfo->rbuf + finfo->cursor_pos, finfo->unread_bytes);
+            finfo->cursor_pos = 0;
+        }
+
+        while (finfo->unread_bytes < min)
+        {
+            ssize_t res = rio_sys_read(finfo, finfo->rbuf + finfo->unread_bytes, BUFFER_SIZE - finfo->unread_bytes);
+            if (res < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                perror("read");
+                return -1;
+            }
+
+            if (res == 0) // EOF
+            {
+                break;
+            }
+
+            finfo->unread_bytes += res;
+        }
+    }
+
+    *ptr = finfo->base + finfo->cursor_pos;
+    *avail = finfo->unread_bytes;
+    return 0;
+}
+
+/**
+ * Mark bytes returned by rio_peek as read
+ * Returns 0 on success, -1 if more bytes are consumed than are buffered
+ */
+int rio_consume(rio_t finfo, size_t bytes)
+{
+    if (!finfo || bytes > finfo->unread_bytes)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    finfo->cursor_pos += bytes;
+    finfo->unread_bytes -= bytes;
+    return 0;
+}
+
+/**
+ * Buffered write: small writes are coalesced in the write buffer, a write of at least BUFFER_SIZE bytes goes straight
+ * to the file after the pending bytes
+ * Buffered bytes are written out by rio_flush, a read, rio_seek or rio_close
+ * Returns bytes accepted, -1 on error
+ */
+ssize_t rio_writeb(rio_t finfo, const void *usr_buf, size_t bytes_to_write)
+{
+    if (!finfo || !usr_buf)
+    {
+        return -1;
+    }
+
+    if (finfo->wbuf_len == 0)
+    {
+        rio_drop_readahead(finfo);
+    }
+
+    if (finfo->wbuf_len + bytes_to_write > BUFFER_SIZE && finfo->wbuf_len &&
+        rio_flush_cause(finfo, RIO_FLUSH_FULL) < 0)
+    {
+        return -1;
+    }
+
+    if (bytes_to_write >= BUFFER_SIZE)
+    {
+        return rio_writen(finfo, usr_buf, bytes_to_write);
+    }
+
+    memcpy(finfo->wbuf + finfo->wbuf_len, usr_buf, bytes_to_write);
+    finfo->wbuf_len += bytes_to_write;
+    return bytes_to_write;
+}
+
+/**
+ * Write out everything buffered by rio_writeb
+ * Returns 0 on success, -1 on error (unwritten bytes stay buffered)
+ */
+int rio_flush(rio_t finfo)
+{
+    if (!finfo)
+    {
+        return -1;
+    }
+
+    return (finfo->wbuf_len) ? rio_flush_cause(finfo, RIO_FLUSH_EXPLICIT) : 0;
+}
+
+/**
+ * Give positional reads a shared page cache of pages * RIO_PAGE_SIZE bytes, pages == 0 removes it
+ * Set it up before other threads start using finfo, the cache itself is safe for concurrent rio_preadn/rio_pwriten
+ * Writes through this rio_t keep it coherent, changes made through other descriptors are not seen
+ * Returns 0 on success, -1 on error
+ */
+int rio_enable_pcache(rio_t finfo, size_t pages)
+{
+    if (!finfo)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    struct rio_pcache *old = finfo->pcache;
+    finfo->pcache = NULL;
+    if (old)
+    {
+        for (int i = 0; i < RIO_PCACHE_STRIPES; i++)
+        {
+            pthread_mutex_destroy(&old->locks[i]);
+        }
+        free(old->pages);
+        free(old);
+    }
+
+    if (pages == 0)
+    {
+        return 0;
+    }
+
+    struct rio_pcache *pc = malloc(sizeof(struct rio_pcache));
+    if (!pc)
+    {
+        perror("malloc");
+        return -1;
+    }
+    pc->pages = malloc(pages * sizeof(struct rio_page));
+    if (!pc->pages)
+    {
+        perror("malloc");
+        free(pc);
+        return -1;
+    }
+
+    pc->npages = pages;
+    pc->epoch = 0;
+    pc->eof_page = -1;
+    for (size_t i = 0; i < pages; i++)
+    {
+        pc->pages[i].page_no = -1;
+    }
+    for (int i = 0; i < RIO_PCACHE_STRIPES; i++)
+    {
+        pthread_mutex_init(&pc->locks[i],NULL);
+    }
+
+    finfo->pcache = pc;
+    return 0;
+}
+
+/**
+ * Copy len bytes at in-page offset skip of page pno out of the cache, loading the page on a miss
+ * Returns bytes copied (fewer at the end of the file), -1 on error
+ */
+static ssize_t rio_pcache_read(rio_t finfo, char *dst, off_t pno, size_t skip, size_t len)
+{
+    struct rio_pcache *pc = finfo->pcache;
+    size_t slot = rio_pcache_slot(pc,pno);
+    struct rio_page *pg = &pc->pages[slot];
+    pthread_mutex_t *lock = &pc->locks[slot % RIO_PCACHE_STRIPES];
+
+    pthread_mutex_lock(lock);
+    if (pg->page_no != pno)
+    {
+        // Miss: read the page without holding the stripe, then install it unless a write raced with the read
+        pthread_mutex_unlock(lock);
+        unsigned long epoch = __atomic_load_n(&pc->epoch,__ATOMIC_SEQ_CST);
+        char page[RIO_PAGE_SIZE];
+        size_t got = 0;
+        while (got < RIO_PAGE_SIZE)
+        {
+            ssize_t r = rio_sys_pread(finfo, page + got, RIO_PAGE_SIZE - got, pno * RIO_PAGE_SIZE + got);
+            if (r < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                perror("pread");
+                return -1;
+            }
+            if (r == 0) // EOF
+            {
+                break;
+            }
+            got += r;
+        }
+
+        pthread_mutex_lock(lock);
+        if (__atomic_load_n(&pc->epoch,__ATOMIC_SEQ_CST) != epoch)
+        {
+            pthread_mutex_unlock(lock);
+            size_t n = (got > skip) ? got - skip : 0;
+            n = (n > len) ? len : n;
+            memcpy(dst, page + skip, n);
+            return n;
+        }
+        pg->page_no = pno;
+        pg->len = got;
+        memcpy(pg->data, page, got);
+        if (got < RIO_PAGE_SIZE)
+        {
+            __atomic_store_n(&pc->eof_page,pno,__ATOMIC_SEQ_CST);
+        }
+    }
+
+    size_t n = (pg->len > skip) ? pg->len - skip : 0;
+    if (n > len)
+    {
+        n = len;
+    }
+    memcpy(dst, pg->data + skip, n);
+    pthread_mutex_unlock(lock);
+    return n;
+}
+
+/**
+ * Read bytes at offset into user buffer without using or moving the file offset or the read buffer
+ * Safe to call from many threads on one rio_t, reads go through the page cache when one is enabled
+ * Like rio_readn all requested bytes are read unless an error occurs, fewer on EOF
+ * Bytes still buffered by rio_writeb are not seen until rio_flush
+ */
+ssize_t rio_preadn(rio_t finfo, void *usr_buf, size_t bytes_to_read, off_t offset)
 {
-    rio_t finfo = malloc(sizeof(struct fdata));
-    int df;
-    if (!finfo)
+    if (!finfo || !usr_buf || offset < 0)
     {
-        perror("malloc");
-        return NULL;
+        return -1;
     }
-    memset(finfo,0,sizeof(struct fdata)); // zero out for safety
-    if (flags & O_CREAT)
+
+    char *ub = (char *)(usr_buf);
+    size_t total_read = 0;
+
+    if (finfo->pcache && bytes_to_read < RIO_PCACHE_BYPASS)
     {
-        df = open(pathname,flags,mode);
-        if (df < 0)
+        while (total_read < bytes_to_read)
         {
-            perror("open");
-            free(finfo);
-            return NULL;
+            off_t pos = offset + (off_t)total_read;
+            size_t skip = pos % RIO_PAGE_SIZE;
+            size_t want = (RIO_PAGE_SIZE - skip < bytes_to_read - total_read) ? RIO_PAGE_SIZE - skip : bytes_to_read - total_read;
+            ssize_t n = rio_pcache_read(finfo, ub + total_read, pos / RIO_PAGE_SIZE, skip, want);
+            if (n < 0)
+            {
+                return -1;
+            }
+            total_read += n;
+            if ((size_t)n < want) // EOF
+            {
+                break;
+            }
         }
-        finfo->fd = df;
-    } else
+        return total_read;
+    }
+
+    while (total_read < bytes_to_read)
     {
-        df = open(pathname,flags,0);
-        if (df < 0)
+        ssize_t itr_read = rio_sys_pread(finfo, ub + total_read, bytes_to_read - total_read, offset + (off_t)total_read);
+        if (itr_read < 0)
         {
-            perror("open");
-            return NULL;
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            perror("pread");
+            return -1;
         }
-        finfo->fd = df;
+
+        if (itr_read == 0) // EOF
+        {
+            break;
+        }
+
+        total_read += itr_read;
     }
-    return finfo;
+
+    return total_read;
 }
 
 /**
- * Close file by passing rio_t struct that has file metadata
- * If file is not closed, struct is intact and can be used to retry operation
+ * Write bytes from user buffer at offset without using or moving the file offset
+ * Safe to call from many threads on one rio_t, overlapping cached pages are dropped
+ * Like rio_writen all requested bytes are written unless an error occurs
  */
-void rio_close(rio_t finfo)
+ssize_t rio_pwriten(rio_t finfo, const void *usr_buf, size_t bytes_to_write, off_t offset)
 {
-    if (!finfo)
+    if (!finfo || !usr_buf || offset < 0)
     {
-        return;
-
+        return -1;
     }
-    int df = finfo->fd;
-    int c = close(df);
-    if (c < 0)
+
+    const char *ub = (const char *)(usr_buf);
+    size_t total_wrote = 0;
+    while (total_wrote < bytes_to_write)
     {
-        perror("close");
-        return;
+        ssize_t itr_wrote = rio_sys_pwrite(finfo, ub + total_wrote, bytes_to_write - total_wrote, offset + (off_t)total_wrote);
+        if (itr_wrote < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            perror("pwrite");
+            break;
+        }
+
+        if (itr_wrote == 0) // Abnormal behaviour, exit with error
+        {
+            break;
+        }
+        total_wrote += itr_wrote;
     }
 
-    free(finfo);
+    if (finfo->pcache && total_wrote)
+    {
+        rio_pcache_invalidate(finfo->pcache, offset, total_wrote);
+    }
 
+    return (total_wrote == bytes_to_write) ? (ssize_t)total_wrote : -1;
 }
 
 /**
- * Move read/write file pointer by specfic offset by using relative postion using lseek
- * Returns offset from start.
+ * Current logical offset: where the next buffered read starts or the next write lands
+ * Accounts for unread and unflushed bytes and needs no syscall (except once after an O_APPEND write)
+ * Returns the offset, -1 with errno ESPIPE for pipes and sockets
  */
-off_t rio_seek(rio_t finfo, off_t offset, int whence)
+off_t rio_tell(rio_t finfo)
 {
     if (!finfo)
     {
+        errno = EINVAL;
         return (off_t)-1;
     }
-    off_t res = lseek(finfo->fd,offset,whence);
-    if (res < 0)
+
+    if (finfo->mmapped)
     {
-        perror("seek");
+        return finfo->map_off + (off_t)finfo->cursor_pos;
+    }
+
+    if (!finfo->seekable)
+    {
+        errno = ESPIPE;
         return (off_t)-1;
     }
 
-    finfo->cursor_pos = 0;
-    finfo->unread_bytes = 0;
-    return res;
+    if (finfo->fd_off < 0)
+    {
+        finfo->fd_off = lseek(finfo->fd,0,SEEK_CUR);
+        if (finfo->fd_off < 0)
+        {
+            perror("seek");
+            return (off_t)-1;
+        }
+    }
 
+    return finfo->fd_off - (off_t)finfo->unread_bytes + (off_t)finfo->wbuf_len;
 }
 
 /**
- * Print state of buffer for debugging
+ * Gather write: all bytes of the iovcnt buffers are written in order, in as few writev calls as the kernel allows
+ * Partially written iovecs are resumed, the caller's array is not modified
+ * This function guarantees all bytes will be written unless an error occurs
+ * Returns bytes written, -1 on error
  */
-void rio_dump_state(rio_t finfo)
+ssize_t rio_writev(rio_t finfo, const struct iovec *iov, int iovcnt)
 {
-    if (!finfo)
+    if (!finfo || !iov || iovcnt < 0)
     {
-        puts("No file metadata found.");
-        return;
+        return -1;
     }
 
-    puts("--- File Information ---");
-    printf("File descriptor: %d\n", finfo->fd);
-    printf("Current buffer position: %zu\n", finfo->cursor_pos);
-    printf("Unread bytes left in buffer: %zu\n", finfo->unread_bytes);
+    // Keep the byte order of earlier buffered writes and write where reading left off
+    if (finfo->wbuf_len && rio_flush_cause(finfo, RIO_FLUSH_EXPLICIT) < 0)
+    {
+        return -1;
+    }
+    rio_drop_readahead(finfo);
+
+    size_t total_wrote = 0;
+    for (int first = 0; first < iovcnt; first += RIO_IOV_BATCH)
+    {
+        struct iovec batch[RIO_IOV_BATCH];
+        int cnt = (iovcnt - first < RIO_IOV_BATCH) ? iovcnt - first : RIO_IOV_BATCH;
+        memcpy(batch, iov + first, cnt * sizeof(struct iovec));
+
+        struct iovec *cur = batch;
+        rio_iov_advance(&cur, &cnt, 0); // Skip leading empty iovecs
+        while (cnt > 0)
+        {
+            ssize_t itr_wrote = rio_sys_writev(finfo, cur, cnt);
+            if (itr_wrote < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                perror("writev");
+                return -1;
+            }
+
+            if (itr_wrote == 0) // Abnormal behaviour, exit with error
+            {
+                return -1;
+            }
 
+            total_wrote += itr_wrote;
+            rio_iov_advance(&cur, &cnt, itr_wrote);
+        }
+    }
+
+    return total_wrote;
 }
 
 /**
- * Read bytes requested into user buffer (user must make sure buffer is big enough to handle request)
- * This function guarantees all of bytes requested will be read unless an devastating error occurs, fewer on (EOF)
+ * Scatter read: fill the iovcnt buffers in order, bytes already in the read buffer are used first
+ * Partially filled iovecs are resumed, the caller's array is not modified
+ * This function guarantees all requested bytes will be read unless an error occurs, fewer on EOF
+ * Returns bytes read, -1 on error
  */
-ssize_t rio_readn(rio_t finfo, void *usr_buf, size_t bytes_to_read)
+ssize_t rio_readv(rio_t finfo, const struct iovec *iov, int iovcnt)
 {
-    if (!finfo || !usr_buf)
+    if (!finfo || !iov || iovcnt < 0)
+    {
+        return -1;
+    }
+
+    if (finfo->wbuf_len && rio_flush_cause(finfo, RIO_FLUSH_EXPLICIT) < 0) // Reads see earlier buffered writes
     {
         return -1;
     }
 
-    char *ub = (char *)(usr_buf);
     size_t total_read = 0;
-    while(total_read < bytes_to_read)
+    for (int first = 0; first < iovcnt; first += RIO_IOV_BATCH)
     {
-        ssize_t itr_read = read(finfo->fd, ub + total_read, bytes_to_read - total_read);
-        if (itr_read < 0)
+        struct iovec batch[RIO_IOV_BATCH];
+        int cnt = (iovcnt - first < RIO_IOV_BATCH) ? iovcnt - first : RIO_IOV_BATCH;
+        memcpy(batch, iov + first, cnt * sizeof(struct iovec));
+
+        struct iovec *cur = batch;
+        rio_iov_advance(&cur, &cnt, 0);
+
+        // Drain the read buffer (or copy out of the mapping) before going to the file
+        while (cnt > 0 && (finfo->unread_bytes || finfo->mmapped))
         {
-            if (errno == EINTR)
+            if (finfo->unread_bytes == 0)
             {
-                continue;
+                ssize_t res = rio_fill(finfo);
+                if (res < 0)
+                {
+                    return -1;
+                }
+                if (res == 0) // EOF
+                {
+                    return total_read;
+                }
             }
-            perror("read");
-            return -1;
+
+            size_t chunk = (finfo->unread_bytes < cur->iov_len) ? finfo->unread_bytes : cur->iov_len;
+            memcpy(cur->iov_base, finfo->base + finfo->cursor_pos, chunk);
+            finfo->cursor_pos += chunk;
+            finfo->unread_bytes -= chunk;
+            total_read += chunk;
+            rio_iov_advance(&cur, &cnt, chunk);
         }
 
-        if (itr_read == 0) // EOF
+        if (cnt > 0)
         {
-            break;
-        } 
+            finfo->cursor_pos = 0; // rbuf is drained, it no longer sits just before the file offset
+        }
+        while (cnt > 0)
+        {
+            ssize_t itr_read = rio_sys_readv(finfo, cur, cnt);
+            if (itr_read < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                perror("readv");
+                return -1;
+            }
 
-        total_read += itr_read;
+            if (itr_read == 0) // EOF
+            {
+                return total_read;
+            }
+
+            total_read += itr_read;
+            rio_iov_advance(&cur, &cnt, itr_read);
+        }
     }
 
     return total_read;
 }
 
+#ifdef __linux__
+enum
+{
+    RIO_COPY_RANGE, // copy_file_range: regular file to regular file
+    RIO_COPY_SPLICE, // splice: either side is a pipe
+    RIO_COPY_SENDFILE // sendfile: regular file to anything else (sockets)
+};
+
 /**
- * Write bytes from user buffer (user must make sure buffer is big enough to handle request)
- * This function guarantees all of bytes requested will be wrote unless an devasting error occurs
+ * Move up to n bytes from src to dst inside the kernel with one method
+ * off_in is the source offset for mapped files (the file offset is not used there), NULL to read at the file offset
+ * Returns bytes moved (fewer on EOF), -1 with errno set, errno is EINVAL/ENOSYS/EXDEV/EOPNOTSUPP when the method
+ * does not support these files and nothing was moved
  */
-ssize_t rio_writen(rio_t finfo, const void *usr_buf, size_t bytes_to_write)
+static ssize_t rio_copy_kernel(int method, rio_t dst, rio_t src, off_t *off_in, size_t n)
 {
-    if (!finfo || !usr_buf)
+    size_t total = 0;
+    while (total < n)
     {
-        return -1;
-    }
+        size_t chunk = (n - total < RIO_COPY_CHUNK) ? n - total : RIO_COPY_CHUNK;
+        ssize_t res;
+        switch (method)
+        {
+            case RIO_COPY_RANGE: res = copy_file_range(src->fd, off_in, dst->fd, NULL, chunk, 0); break;
+            case RIO_COPY_SPLICE: res = splice(src->fd, off_in, dst->fd, NULL, chunk, SPLICE_F_MOVE); break;
+            default: res = sendfile(dst->fd, src->fd, off_in, chunk); break;
+        }
 
-    const char *ub = (char *)(usr_buf);
-    size_t total_wrote = 0;
-    while(total_wrote < bytes_to_write)
-    {
-        ssize_t itr_wrote = write(finfo->fd, ub + total_wrote, bytes_to_write - total_wrote);
-        if (itr_wrote < 0)
+        if (res < 0)
         {
             if (errno == EINTR)
             {
                 continue;
             }
-            perror("write");
+            if (total)
+            {
+                break; // Report what was moved, the error comes back on the next call
+            }
             return -1;
         }
 
-        if (itr_wrote == 0) // Abnormal behaviour, exit with error
+        if (res == 0) // EOF
         {
-            return -1;
+            break;
         }
-        total_wrote += itr_wrote;
-    }
 
-    return total_wrote;
+        total += res;
+        RIO_STAT(src,bytes_read,res);
+        RIO_STAT(dst,bytes_written,res);
+    }
 
+    return total;
 }
+#endif
 
 /**
- * Attempt to read bytes from file and put fill user buffer (use internal buffer when buffer size is respectable w.r.t to constraint)
- * If request is to big, handle it with readn()
- *  Return up to N bytes with minimal syscalls, handling partial reads correctly
+ * Copy n bytes from the current position of src to the current position of dst, fewer if src reaches EOF
+ * Bytes already in the read buffer of src go first, the rest is moved inside the kernel when the file types allow it:
+ * copy_file_range between regular files, splice when either side is a pipe, sendfile from a regular file
+ * Otherwise it falls back to a large-buffer read/write loop
+ * Returns bytes copied, -1 on error
  */
-ssize_t rio_read(rio_t finfo, void *usr_buf, size_t bytes_to_read)
+ssize_t rio_copy(rio_t dst, rio_t src, size_t n)
 {
-    if (!finfo || !usr_buf)
+    if (!dst || !src)
     {
         return -1;
     }
 
-    char *ub = (char *)(usr_buf);
-    ssize_t res;
-    if (bytes_to_read > BUFFER_SIZE)
+    if ((src->wbuf_len && rio_flush_cause(src, RIO_FLUSH_EXPLICIT) < 0) ||
+        (dst->wbuf_len && rio_flush_cause(dst, RIO_FLUSH_EXPLICIT) < 0))
     {
-        size_t buffered_bytes = (finfo->unread_bytes > bytes_to_read) ? bytes_to_read : finfo->unread_bytes;
-        if (buffered_bytes)
+        return -1;
+    }
+    rio_drop_readahead(dst);
+
+    size_t total = 0;
+
+    // Drain what src has already read ahead
+    if (!src->mmapped && src->unread_bytes)
+    {
+        size_t chunk = (src->unread_bytes < n) ? src->unread_bytes : n;
+        if (rio_writen(dst, src->base + src->cursor_pos, chunk) < 0)
         {
-            memcpy(ub,finfo->rbuf + finfo->cursor_pos,buffered_bytes);
-            ub += buffered_bytes;
-            bytes_to_read -= buffered_bytes;
-            finfo->unread_bytes = 0;
-            finfo->cursor_pos = 0;
+            return -1;
+        }
+        src->cursor_pos += chunk;
+        src->unread_bytes -= chunk;
+        total += chunk;
+        if (total == n)
+        {
+            return total;
         }
+    }
+    if (!src->mmapped)
+    {
+        src->cursor_pos = 0; // rbuf is drained, the copy moves the file offset past it
+    }
 
-        res = rio_readn(finfo,ub,bytes_to_read);
-        if (res < 0)
+    // Mapped files copy from their logical position, their file offset is never used
+    off_t pos = src->map_off + (off_t)src->cursor_pos;
+    off_t *off_in = (src->mmapped) ? &pos : NULL;
+
+#ifdef __linux__
+    struct stat sst;
+    struct stat dst_st;
+    if (fstat(src->fd, &sst) == 0 && fstat(dst->fd, &dst_st) == 0)
+    {
+        int methods[3];
+        int count = 0;
+        if (S_ISREG(sst.st_mode) && S_ISREG(dst_st.st_mode) && !dst->append)
         {
-            return -1;
+            methods[count++] = RIO_COPY_RANGE;
+        }
+        if (S_ISFIFO(sst.st_mode) || S_ISFIFO(dst_st.st_mode))
+        {
+            methods[count++] = RIO_COPY_SPLICE;
+        }
+        if (S_ISREG(sst.st_mode))
+        {
+            methods[count++] = RIO_COPY_SENDFILE;
+        }
+
+        for (int i = 0; i < count; i++)
+        {
+            ssize_t res = rio_copy_kernel(methods[i], dst, src, off_in, n - total);
+            if (res < 0)
+            {
+                if (errno == EINVAL || errno == ENOSYS || errno == EXDEV || errno == EOPNOTSUPP)
+                {
+                    continue; // Not supported for these files, try the next method
+                }
+                perror("rio_copy");
+                return -1;
+            }
+
+            total += res;
+            if (src->mmapped)
+            {
+                rio_seek(src, pos, SEEK_SET);
+            } else if (src->fd_off >= 0)
+            {
+                src->fd_off += res;
+            }
+            if (dst->fd_off >= 0)
+            {
+                dst->fd_off = (dst->append) ? -1 : dst->fd_off + res;
+            }
+            rio_window_reset(dst);
+            rio_pcache_written(dst, res);
+            return total;
         }
-        return (res + buffered_bytes);
     }
+#endif
 
-    // Read into internal buffer
-    if (finfo->unread_bytes == 0)
+    // Fallback: mapped sources write straight out of the mapping, others bounce through one large buffer
+    if (src->mmapped)
     {
-    read:
-        res = read(finfo->fd, finfo->rbuf, BUFFER_SIZE);
-        if (res < 0)
+        while (total < n)
+        {
+            if (src->unread_bytes == 0)
+            {
+                ssize_t res = rio_fill(src);
+                if (res < 0)
+                {
+                    return -1;
+                }
+                if (res == 0) // EOF
+                {
+                    break;
+                }
+            }
+
+            size_t chunk = (src->unread_bytes < n - total) ? src->unread_bytes : n - total;
+            if (rio_writen(dst, src->base + src->cursor_pos, chunk) < 0)
+            {
+                return -1;
+            }
+            src->cursor_pos += chunk;
+            src->unread_bytes -= chunk;
+            total += chunk;
+        }
+        return total;
+    }
+
+    size_t cap = (n - total < RIO_COPY_CHUNK) ? n - total : RIO_COPY_CHUNK;
+    char *bounce = malloc(cap);
+    if (!bounce)
+    {
+        perror("malloc");
+        return -1;
+    }
+
+    while (total < n)
+    {
+        size_t want = (n - total < cap) ? n - total : cap;
+        ssize_t r = rio_sys_read(src, bounce, want);
+        if (r < 0)
         {
             if (errno == EINTR)
             {
-                goto read;
+                continue;
             }
             perror("read");
+            free(bounce);
             return -1;
         }
 
-        if (res == 0)
+        if (r == 0) // EOF
         {
-            return 0;
+            break;
         }
 
-        finfo->unread_bytes = res;
-        finfo->cursor_pos = 0;
+        if (rio_writen(dst, bounce, r) < 0)
+        {
+            free(bounce);
+            return -1;
+        }
+        total += r;
     }
 
-    ssize_t bytes_read = (finfo->unread_bytes > bytes_to_read) ? bytes_to_read : finfo->unread_bytes;
-    memcpy(usr_buf,finfo->rbuf + finfo->cursor_pos,bytes_read);
-    finfo->cursor_pos += bytes_read;
-    finfo->unread_bytes -= bytes_read;
-
-    return bytes_read;
+    free(bounce);
+    return total;
 }
\ No newline at end of file
@@ -0,0 +1,22 @@
+// Minimal checks for the test programs, each prints its failures and exits non-zero if there were any
+#pragma once
+
+#include <stdio.h>
+
+static int check_failures;
+
+#define CHECK(cond) \
+    do \
+    { \
+        if (!(cond)) \
+        { \
+            fprintf(stderr,"%s:%d: check failed: %s\n",__FILE__,__LINE__,#cond); \
+            check_failures++; \
+        } \
+    } while (0)
+
+static int check_done(const char *name)
+{
+    printf("%s: %s\n",name,check_failures ? "FAILED" : "ok");
+    return check_failures ? 1 : 0;
+}
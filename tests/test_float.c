@@ -0,0 +1,133 @@
+// Shortest double output must read back through strtod to the same bits, fixed precision must be correctly
+// rounded from the exact binary value (checked against glibc, which is)
+#include "../mystdio/mystdio.c"
+#include "check.h"
+
+#include <float.h>
+
+// Format v into buf through a memory stream
+static void format(char *buf, size_t size, const char *fmt, double v)
+{
+    file_t f = my_fmemopen(buf,size,"w");
+    my_printf(f,fmt,v);
+    my_fclose(f);
+}
+
+static int round_trips(double v)
+{
+    char buf[64];
+    format(buf,sizeof(buf),"%~g",v);
+    double back = strtod(buf,NULL);
+    if (memcmp(&back,&v,sizeof(v)) != 0)
+    {
+        fprintf(stderr,"%.17g printed as %s\n",v,buf);
+        return 0;
+    }
+    return 1;
+}
+
+static int matches_glibc(const char *fmt, double v)
+{
+    char mine[1024], ref[1024];
+    format(mine,sizeof(mine),fmt,v);
+    snprintf(ref,sizeof(ref),fmt,v);
+    if (strcmp(mine,ref) != 0)
+    {
+        fprintf(stderr,"%s of %.17g: %s, expected %s\n",fmt,v,mine,ref);
+        return 0;
+    }
+    return 1;
+}
+
+static unsigned long long xorshift(unsigned long long *x)
+{
+    *x ^= *x << 13;
+    *x ^= *x >> 7;
+    *x ^= *x << 17;
+    return *x;
+}
+
+static void test_fixed_precision(void)
+{
+    // Ties and near-ties that shortest-digit rounding gets wrong
+    CHECK(matches_glibc("%.2f",2.675));
+    CHECK(matches_glibc("%.1f",0.25));
+    CHECK(matches_glibc("%.1f",0.35));
+    CHECK(matches_glibc("%.0f",0.5));
+    CHECK(matches_glibc("%.0f",1.5));
+    CHECK(matches_glibc("%.0f",2.5));
+    CHECK(matches_glibc("%.3f",1.0005));
+    CHECK(matches_glibc("%f",0.1));
+    CHECK(matches_glibc("%e",0.1));
+    CHECK(matches_glibc("%g",0.1));
+    CHECK(matches_glibc("%f",1e300));
+    CHECK(matches_glibc("%.30e",5e-324));
+    CHECK(matches_glibc("%.400f",2.2250738585072009e-308));
+    CHECK(matches_glibc("%g",100000));
+    CHECK(matches_glibc("%g",1e6));
+    CHECK(matches_glibc("%.3g",9995));
+    CHECK(matches_glibc("%G",1e-5));
+
+    static const char *fmts[] = {"%f", "%e", "%g", "%.0f", "%.1f", "%.2f", "%.3f", "%.10f", "%.0e", "%.3e",
+                                 "%.17e", "%.25e", "%.1g", "%.4g", "%.17g", "%.20g"};
+    unsigned long long x = 0x2545F4914F6CDD1DULL;
+    int bad = 0;
+    for (int i = 0; i < 200000 && bad <= 10; i++)
+    {
+        // Half the values are short decimals like 12.345, where ties are common
+        double v;
+        if (i & 1)
+        {
+            v = (double)(xorshift(&x) % 1000000) / pow(10,(int)(xorshift(&x) % 7));
+        } else
+        {
+            unsigned long long b = xorshift(&x);
+            memcpy(&v,&b,sizeof(v));
+            if (!isfinite(v))
+            {
+                continue;
+            }
+        }
+        const char *fmt = fmts[xorshift(&x) % (sizeof(fmts) / sizeof(fmts[0]))];
+        if (!matches_glibc(fmt,v))
+        {
+            bad++;
+        }
+    }
+    CHECK(bad == 0);
+}
+
+int main(void)
+{
+    test_fixed_precision();
+
+    static const double edges[] = {0.0, -0.0, 1.0, -1.0, 0.1, 0.2, 0.3, 1e23, 9007199254740993.0, 5e-324,
+                                   2.2250738585072009e-308, DBL_MIN, DBL_MAX, DBL_EPSILON, 1e-300, 1e300,
+                                   123456789012345678.0, 0.000001, 1e21, 1e22};
+    for (size_t i = 0; i < sizeof(edges) / sizeof(edges[0]); i++)
+    {
+        CHECK(round_trips(edges[i]));
+    }
+    for (int e = -320; e <= 308; e++)
+    {
+        CHECK(round_trips(pow(10,e)));
+    }
+
+    // Random bit patterns cover every exponent, subnormals included
+    unsigned long long x = 0x9E3779B97F4A7C15ULL;
+    int bad = 0;
+    for (int i = 0; i < 1000000; i++)
+    {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        double v;
+        memcpy(&v,&x,sizeof(v));
+        if (isfinite(v) && !round_trips(v) && ++bad > 10)
+        {
+            break;
+        }
+    }
+    CHECK(bad == 0);
+    return check_done("test_float");
+}
@@ -0,0 +1,67 @@
+// Checks for my_format.hpp, linked against the mystdio object
+// Built with -DMY_FORMAT_BAD=n it must fail to compile, make test checks each n
+#include "../mystdio/my_format.hpp"
+#include "check.h"
+
+#include <climits>
+#include <cstring>
+
+extern "C"
+{
+file_t my_fmemopen(void *buf, size_t size, const char *fmode);
+int my_fclose(file_t f);
+}
+
+static char out[256];
+
+static file_t open_out()
+{
+    memset(out,0,sizeof(out));
+    return my_fmemopen(out,sizeof(out) - 1,"w");
+}
+
+static void test_output()
+{
+    file_t f = open_out();
+    CHECK(my_format<"id=%d name=%s %c%%">(f,42,"ab",'!') == 16);
+    my_fclose(f);
+    CHECK(!strcmp(out,"id=42 name=ab !%"));
+
+    f = open_out();
+    CHECK(my_format<"%d %lld %u %x %zu %zx">(f,INT_MIN,LLONG_MIN,UINT_MAX,255u,(size_t)0,(size_t)4096) > 0);
+    my_fclose(f);
+    CHECK(!strcmp(out,"-2147483648 -9223372036854775808 4294967295 ff 0 1000"));
+
+    f = open_out();
+    CHECK(my_format<"%s|%p">(f,(const char *)nullptr,(void *)0x1f) == 9);
+    my_fclose(f);
+    CHECK(!strcmp(out,"NULL|0x1f"));
+
+    // A format without conversions writes nothing and takes no arguments
+    f = open_out();
+    CHECK(my_format<"">(f) == 0);
+    CHECK(my_format<"plain">(f) == 5);
+    my_fclose(f);
+    CHECK(!strcmp(out,"plain"));
+
+    CHECK(my_format<"%d">(nullptr,1) == -1);
+}
+
+#if MY_FORMAT_BAD == 1
+static void bad() { my_format<"%d">(nullptr,1L); } // long for %d
+#elif MY_FORMAT_BAD == 2
+static void bad() { my_format<"%d %d">(nullptr,1); } // Argument count
+#elif MY_FORMAT_BAD == 3
+static void bad() { my_format<"%f">(nullptr,1.0); } // Unsupported conversion
+#elif MY_FORMAT_BAD == 4
+static void bad() { my_format<"%s">(nullptr,42); } // Not a string
+#endif
+
+int main()
+{
+#ifdef MY_FORMAT_BAD
+    bad();
+#endif
+    test_output();
+    return check_done("test_format");
+}
@@ -0,0 +1,415 @@
+// Regression checks for mystdio
+#include "../mystdio/mystdio.c"
+#include "check.h"
+#include <limits.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+static void test_write_read(void)
+{
+    char path[] = "/tmp/test_mystdio_XXXXXX";
+    int fd = mkstemp(path);
+    file_t f = my_fdopen(fd,WRITE);
+    CHECK(my_puts("hello",f) >= 0);
+    CHECK(my_printf(f,"%d %s\n",42,"x") == 5);
+    CHECK(my_fclose(f) == 0);
+
+    f = my_fopen(path,"r");
+    char line[32];
+    CHECK(my_fgets(line,sizeof(line),f) && !strcmp(line,"hello\n"));
+    CHECK(my_fgets(line,sizeof(line),f) && !strcmp(line,"42 x\n"));
+    CHECK(my_getc(f) == EOF);
+    my_fclose(f);
+    unlink(path);
+}
+
+// Write-behind keeps byte order across many buffer swaps
+static void test_async(void)
+{
+    char path[] = "/tmp/test_mystdio_XXXXXX";
+    int fd = mkstemp(path);
+    file_t f = my_fdopen(fd,WRITE);
+    CHECK(my_set_async(f,1) == 0);
+    for (int i = 0; i < 100000; i++)
+    {
+        my_printf(f,"%d\n",i);
+    }
+    CHECK(my_fclose(f) == 0);
+
+    f = my_fopen(path,"r");
+    char line[32];
+    int i = 0;
+    while (my_fgets(line,sizeof(line),f) && atoi(line) == i)
+    {
+        i++;
+    }
+    CHECK(i == 100000);
+    my_fclose(f);
+    unlink(path);
+}
+
+// Failed background writes must come back from my_fclose
+static void test_close_reports_errors(void)
+{
+    file_t f = my_fopen("/dev/full","w");
+    CHECK(my_set_async(f,1) == 0);
+    for (int i = 0; i < 10000; i++)
+    {
+        my_puts("filling /dev/full",f);
+    }
+    errno = 0;
+    CHECK(my_fclose(f) == -1 && errno == ENOSPC);
+
+    f = my_fopen("/dev/full","w");
+    my_puts("x",f);
+    errno = 0;
+    CHECK(my_fclose(f) == -1 && errno == ENOSPC);
+}
+
+// my_ungetc on a fmemopen stream must not write into the caller's buffer, here a string literal in read-only memory
+static void test_ungetc_readonly(void)
+{
+    static const char text[] = "abc\ndef";
+    file_t f = my_fmemopen((void *)text,sizeof(text) - 1,"r");
+    CHECK(my_getc(f) == 'a');
+    CHECK(my_ungetc('a',f) == 'a');
+    CHECK(my_getc(f) == 'a');
+    CHECK(my_ungetc('X',f) == 'X');
+    CHECK(my_ungetc('Y',f) == -1);
+    char line[16];
+    CHECK(my_fgets(line,sizeof(line),f) && !strcmp(line,"Xbc\n"));
+    CHECK(my_getc(f) == 'd');
+    CHECK(my_ungetc('Z',f) == 'Z');
+    CHECK(my_fread(line,1,sizeof(line),f) == 3 && !memcmp(line,"Zef",3));
+    CHECK(my_getc(f) == EOF);
+    CHECK(!strcmp(text,"abc\ndef"));
+    my_fclose(f);
+}
+
+// A failed newline flush leaves the span buffered, so the write itself succeeded
+static void test_line_flush_error(void)
+{
+    file_t f = my_fopen("/dev/full","w");
+    my_setvbuf(f,NULL,LINE_BUFFERED,0);
+    errno = 0;
+    CHECK(my_fwrite("ab\ncd",1,5,f) == 5);
+    CHECK(f->err == ENOSPC && errno == ENOSPC);
+    CHECK(f->bytes_in_buf == 5);
+    my_fclose(f);
+}
+
+#ifdef MYSTDIO_STATS
+// Pending bytes and the span through the last newline leave in a single writev,
+// even when the span does not fit behind the pending bytes
+static void test_line_single_write(void)
+{
+    char path[] = "/tmp/test_mystdio_XXXXXX";
+    int fd = mkstemp(path);
+    file_t f = my_fdopen(fd,WRITE);
+    my_setvbuf(f,NULL,LINE_BUFFERED,0);
+    static char pending[BUFFER_SIZE - 4];
+    memset(pending,'p',sizeof(pending));
+    CHECK(my_fwrite(pending,1,sizeof(pending),f) == sizeof(pending));
+
+    MY_STATS before, after;
+    my_stats(f,&before);
+    CHECK(my_fwrite(" ab\ncd\nef",1,9,f) == 9);
+    my_stats(f,&after);
+    CHECK(after.write_calls == before.write_calls + 1);
+    CHECK(after.flushes[FLUSH_NEWLINE] == before.flushes[FLUSH_NEWLINE] + 1);
+    CHECK(f->bytes_in_buf == 2);
+    my_fclose(f);
+
+    char tail[9];
+    fd = open(path,O_RDONLY);
+    CHECK(lseek(fd,0,SEEK_END) == (off_t)sizeof(pending) + 9);
+    CHECK(pread(fd,tail,9,sizeof(pending)) == 9 && !memcmp(tail," ab\ncd\nef",9));
+    close(fd);
+    unlink(path);
+}
+
+// A large write that carries the pending bytes in its writev counts as one full-buffer flush of those bytes
+static void test_writev_flush_stats(void)
+{
+    file_t f = my_fopen("/dev/null","w");
+    static char payload[BUFFER_SIZE * 2];
+    CHECK(my_putc('h',f) == 'h');
+
+    MY_STATS before, after;
+    my_stats(f,&before);
+    CHECK(my_fwrite(payload,1,sizeof(payload),f) == sizeof(payload));
+    my_stats(f,&after);
+    CHECK(after.write_calls == before.write_calls + 1);
+    CHECK(after.flushes[FLUSH_FULL] == before.flushes[FLUSH_FULL] + 1);
+    CHECK(after.flushed_bytes == before.flushed_bytes + 1);
+    my_fclose(f);
+}
+#endif
+
+// my_printf against glibc snprintf, one directive per row
+static const struct { const char *fmt; int v; } int_cases[] = {
+    {"%d", INT_MIN}, {"%i", INT_MAX}, {"%12d", -42}, {"%-12d|", 42}, {"%012d", -42},
+    {"%.5d", -42}, {"%.0d", 0}, {"%5.0d|", 0}, {"%+d", 42}, {"%+d", -42}, {"% d", 42},
+    {"%+ d", 42}, {"% 05d", 7}, {"%-+6d|", 7}, {"%hd", 70000}, {"%hhd", 200}, {"%hu", -1},
+    {"%hhx", 0x1ff}, {"%x", -1}, {"%u", -1}, {"%#x", 255}, {"%#X", 255}, {"%#x", 0},
+    {"%#.4x", 0x1f}, {"%#10x", 255}, {"%#010x", 255}, {"%-#10x|", 255}, {"%+u", 5},
+};
+
+static const struct { const char *fmt; long long v; } ll_cases[] = {
+    {"%lld", LLONG_MIN}, {"%lld", LLONG_MAX}, {"%llx", -1}, {"%+lld", 0}, {"%25lld", LLONG_MIN},
+    {"%-25lld|", LLONG_MIN}, {"%.20lld", -1}, {"%#llX", 0xabcdefLL},
+};
+
+static const struct { const char *fmt; double v; } double_cases[] = {
+    {"%+f", 1.5}, {"% e", 1.5}, {"%+g", -0.0}, {"%#.0f", 3.0}, {"%#.0e", 12345.0}, {"%#g", 1.0},
+    {"%#g", 123456789.0}, {"%#.3g", 0.0001}, {"%#g", 0.0}, {"%+.3e", 0.0}, {"% f", NAN},
+    {"%+F", INFINITY}, {"%010.3f", -1.5}, {"%-+10.2f|", 2.25}, {"%+010.1e", 5.0},
+};
+
+static void same_as_snprintf(const char *fmt, const char *want, const char *got)
+{
+    if (strcmp(want,got))
+    {
+        printf("\"%s\": want \"%s\", got \"%s\"\n",fmt,want,got);
+    }
+    CHECK(!strcmp(want,got));
+}
+
+static void test_printf_matches_snprintf(void)
+{
+    char want[128], got[128];
+    for (size_t i = 0; i < sizeof(int_cases) / sizeof(int_cases[0]); i++)
+    {
+        snprintf(want,sizeof(want),int_cases[i].fmt,int_cases[i].v);
+        memset(got,0,sizeof(got));
+        file_t m = my_fmemopen(got,sizeof(got) - 1,"w");
+        my_printf(m,int_cases[i].fmt,int_cases[i].v);
+        my_fclose(m);
+        same_as_snprintf(int_cases[i].fmt,want,got);
+    }
+    for (size_t i = 0; i < sizeof(ll_cases) / sizeof(ll_cases[0]); i++)
+    {
+        snprintf(want,sizeof(want),ll_cases[i].fmt,ll_cases[i].v);
+        memset(got,0,sizeof(got));
+        file_t m = my_fmemopen(got,sizeof(got) - 1,"w");
+        my_printf(m,ll_cases[i].fmt,ll_cases[i].v);
+        my_fclose(m);
+        same_as_snprintf(ll_cases[i].fmt,want,got);
+    }
+    for (size_t i = 0; i < sizeof(double_cases) / sizeof(double_cases[0]); i++)
+    {
+        snprintf(want,sizeof(want),double_cases[i].fmt,double_cases[i].v);
+        memset(got,0,sizeof(got));
+        file_t m = my_fmemopen(got,sizeof(got) - 1,"w");
+        my_printf(m,double_cases[i].fmt,double_cases[i].v);
+        my_fclose(m);
+        same_as_snprintf(double_cases[i].fmt,want,got);
+    }
+}
+
+// Closed streams are parked in the pool and handed out again with nothing left from their previous use
+static void test_pool_reuse(void)
+{
+    // A fmemopen stream closed while its buffer is parked behind an ungetc byte
+    char text[] = "abc";
+    file_t m = my_fmemopen(text,3,"r");
+    CHECK(my_getc(m) == 'a' && my_ungetc('z',m) == 'z');
+    CHECK(m->pushed_buf && m->buffer == &m->pushback);
+    CHECK(my_fclose(m) == 0);
+
+    char other[] = "xy";
+    file_t r = my_fmemopen(other,2,"r");
+    CHECK(r == m); // The pool hands back the block closed last
+    CHECK(!r->pushed_buf && r->pushed_len == 0 && r->pushback == 0 && r->buffer == other);
+    CHECK(my_getc(r) == 'x' && my_getc(r) == 'y' && my_getc(r) == EOF && r->eof);
+    CHECK(my_fclose(r) == 0);
+
+    // Failed writes and end of file do not carry over
+    file_t full = my_fopen("/dev/full","w");
+    CHECK(full == r);
+    my_puts("lost",full);
+    CHECK(my_fflush(full) == -1 && full->err == ENOSPC);
+    CHECK(my_fclose(full) == -1);
+
+    // A write-behind stream leaves no buffers or queue state behind
+    char path[] = "/tmp/test_mystdio_XXXXXX";
+    int fd = mkstemp(path);
+    file_t a = my_fdopen(fd,WRITE);
+    CHECK(a == full && a->err == 0 && a->eof == 0);
+    CHECK(my_set_async(a,1) == 0 && a->async_alloc);
+    for (int i = 0; i < 2000; i++)
+    {
+        my_printf(a,"%d\n",i);
+    }
+    CHECK(my_fclose(a) == 0);
+
+    fd = open(path,O_WRONLY | O_APPEND);
+    file_t f = my_fdopen(fd,WRITE);
+    CHECK(f == a);
+    CHECK(!f->async && !f->spare && !f->async_alloc && !f->inflight_buf && f->inflight_len == 0);
+    CHECK(f->inflight_done == 0 && !f->inflight && f->async_err == 0 && !f->async_next);
+    CHECK(f->buffer == inline_buffer(f) && f->bytes_in_buf == 0 && f->bmode == FULLY_BUFFERED);
+    CHECK(my_puts("end",f) >= 0 && my_fclose(f) == 0);
+
+    f = my_fopen(path,"r");
+    char line[32];
+    int i = 0;
+    while (my_fgets(line,sizeof(line),f) && i < 2000 && atoi(line) == i)
+    {
+        i++;
+    }
+    CHECK(i == 2000 && !strcmp(line,"end\n"));
+    my_fclose(f);
+    unlink(path);
+}
+
+static void flush_and_die(int sig)
+{
+    my_flush_all_signal();
+    signal(sig,SIG_DFL);
+    raise(sig);
+}
+
+// Buffered bytes reach the file when the process dies by SIGTERM (handler) or returns from main (atexit)
+static void test_flush_on_exit(void)
+{
+    for (int by_signal = 1; by_signal >= 0; by_signal--)
+    {
+        char path[] = "/tmp/test_mystdio_XXXXXX";
+        int fd = mkstemp(path);
+        close(fd);
+
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+            signal(SIGTERM,flush_and_die);
+            file_t full = my_fopen(path,"a");
+            file_t line = my_fopen(path,"a");
+            my_setvbuf(line,NULL,LINE_BUFFERED,0);
+            my_puts("full buffered",full);
+            my_fwrite("partial line",1,12,line);
+            if (by_signal)
+            {
+                raise(SIGTERM);
+            }
+            exit(0);
+        }
+
+        int status;
+        CHECK(waitpid(pid,&status,0) == pid);
+        CHECK(by_signal ? (WIFSIGNALED(status) && WTERMSIG(status) == SIGTERM) : (WIFEXITED(status) && WEXITSTATUS(status) == 0));
+
+        char buf[64] = {0};
+        fd = open(path,O_RDONLY);
+        ssize_t n = read(fd,buf,sizeof(buf) - 1);
+        close(fd);
+        unlink(path);
+        CHECK(n == 26);
+        CHECK(strstr(buf,"full buffered\n") && strstr(buf,"partial line"));
+    }
+}
+
+static log_t test_log;
+static atomic_int producers_done;
+
+static void *log_producer(void *arg)
+{
+    (void)arg;
+    for (int i = 0; i < 20000; i++)
+    {
+        my_log_printf(test_log,"record %d\n",i);
+    }
+    return NULL;
+}
+
+// Public drains race the drainer thread, no record may be lost or written twice
+static void *log_extra_drainer(void *arg)
+{
+    (void)arg;
+    while (!atomic_load(&producers_done))
+    {
+        my_log_drain(test_log);
+    }
+    return NULL;
+}
+
+static void test_log_ring(void)
+{
+    char path[] = "/tmp/test_mystdio_XXXXXX";
+    int fd = mkstemp(path);
+    file_t f = my_fdopen(fd,WRITE);
+    test_log = my_log_open(f);
+
+    pthread_t prod[8], drain[2];
+    for (int i = 0; i < 2; i++)
+    {
+        pthread_create(&drain[i],NULL,log_extra_drainer,NULL);
+    }
+    for (int i = 0; i < 8; i++)
+    {
+        pthread_create(&prod[i],NULL,log_producer,NULL);
+    }
+    for (int i = 0; i < 8; i++)
+    {
+        pthread_join(prod[i],NULL);
+    }
+    atomic_store(&producers_done,1);
+    for (int i = 0; i < 2; i++)
+    {
+        pthread_join(drain[i],NULL);
+    }
+
+    size_t dropped = my_log_dropped(test_log);
+    CHECK(my_log_close(test_log) == 0);
+    CHECK(my_fclose(f) == 0);
+
+    f = my_fopen(path,"r");
+    size_t lines = 0;
+    char line[64];
+    while (my_fgets(line,sizeof(line),f))
+    {
+        lines++;
+    }
+    my_fclose(f);
+    unlink(path);
+    CHECK(lines + dropped == 8 * 20000);
+}
+
+// A record that fails to format is released empty, the records around it still arrive
+static void test_log_format_error(void)
+{
+    char path[] = "/tmp/test_mystdio_XXXXXX";
+    int fd = mkstemp(path);
+    file_t f = my_fdopen(fd,WRITE);
+    log_t l = my_log_open(f);
+    CHECK(my_log_printf(l,"a\n") == 2);
+    CHECK(my_log_printf(l,"%ls\n",L"\u00e9") == -1); // Not representable in the C locale
+    CHECK(my_log_printf(l,"b\n") == 2);
+    CHECK(my_log_close(l) == 0);
+    CHECK(my_fclose(f) == 0);
+
+    char buf[16];
+    fd = open(path,O_RDONLY);
+    CHECK(read(fd,buf,sizeof(buf)) == 4 && !memcmp(buf,"a\nb\n",4));
+    close(fd);
+    unlink(path);
+}
+
+int main(void)
+{
+    test_write_read();
+    test_async();
+    test_close_reports_errors();
+    test_ungetc_readonly();
+    test_line_flush_error();
+    test_printf_matches_snprintf();
+#ifdef MYSTDIO_STATS
+    test_line_single_write();
+    test_writev_flush_stats();
+#endif
+    test_pool_reuse();
+    test_flush_on_exit();
+    test_log_ring();
+    test_log_format_error();
+    return check_done("test_mystdio");
+}
@@ -0,0 +1,433 @@
+// Regression checks for rio
+#include "../rio/rio.c"
+#include "check.h"
+
+static char path[] = "/tmp/test_rio_XXXXXX";
+
+// A file whose byte i is (char)i
+static void make_file(size_t len)
+{
+    int fd = mkstemp(path);
+    for (size_t i = 0; i < len; i++)
+    {
+        char c = (char)i;
+        if (write(fd,&c,1) != 1)
+        {
+            perror("write");
+            exit(1);
+        }
+    }
+    close(fd);
+}
+
+static void test_read_seek(void)
+{
+    rio_t r = rio_open(path,O_RDONLY | RIO_NOMMAP,0);
+    char buf[16];
+    CHECK(rio_read(r,buf,10) == 10 && buf[9] == 9);
+    CHECK(rio_seek(r,300,SEEK_SET) == 300);
+    CHECK(rio_read(r,buf,1) == 1 && buf[0] == (char)300);
+    rio_close(r);
+}
+
+// A write moves the file offset past a fully consumed rbuf, seeking back must not land in the stale window
+static void test_seek_after_write(void)
+{
+    rio_t r = rio_open(path,O_RDWR,0);
+    char buf[4096];
+    CHECK(rio_read(r,buf,sizeof(buf)) == sizeof(buf));
+    CHECK(rio_writen(r,"XYZ",3) == 3);
+    CHECK(rio_seek(r,100,SEEK_SET) == 100);
+    CHECK(rio_read(r,buf,1) == 1 && buf[0] == 100);
+    CHECK(rio_seek(r,4096,SEEK_SET) == 4096);
+    CHECK(rio_read(r,buf,3) == 3 && !memcmp(buf,"XYZ",3));
+
+    // Put the original bytes back for the other tests
+    char orig[3] = {(char)4096, (char)4097, (char)4098};
+    CHECK(rio_seek(r,4096,SEEK_SET) == 4096 && rio_writen(r,orig,3) == 3);
+    rio_close(r);
+}
+
+// rio_readn reads at the file offset past the unread rbuf bytes, the window they belonged to is gone
+static void test_seek_after_readn(void)
+{
+    rio_t r = rio_open(path,O_RDONLY | RIO_NOMMAP,0);
+    char buf[128];
+    CHECK(rio_read(r,buf,10) == 10);
+    CHECK(rio_readn(r,buf,100) == 100 && buf[0] == 0);
+    CHECK(rio_seek(r,200,SEEK_SET) == 200);
+    CHECK(rio_read(r,buf,1) == 1 && buf[0] == (char)200);
+    CHECK(rio_tell(r) == 201);
+    rio_close(r);
+}
+
+// Mapped reads follow a file that grows after EOF was reached, and never map past a shrunk end
+static void test_mmap_resize(void)
+{
+    char big[] = "/tmp/test_rio_big_XXXXXX";
+    int fd = mkstemp(big);
+    static char buf[1 << 20];
+    memset(buf,'a',sizeof(buf));
+    CHECK(write(fd,buf,sizeof(buf)) == sizeof(buf));
+
+    rio_t r = rio_open(big,O_RDONLY,0);
+    CHECK(r->mmapped);
+    CHECK(rio_readn(r,buf,sizeof(buf)) == sizeof(buf));
+    CHECK(rio_read(r,buf,1) == 0);
+    CHECK(write(fd,"more",4) == 4);
+    CHECK(rio_read(r,buf,sizeof(buf)) == 4 && !memcmp(buf,"more",4));
+    CHECK(rio_seek(r,-2,SEEK_END) == (off_t)sizeof(buf) + 2);
+    rio_close(r);
+
+    // Grow the mapped file, then seek past the old end: the read must come from the target, not the old end
+    CHECK(ftruncate(fd,3 << 20) == 0);
+    CHECK(pwrite(fd,"T",1,(5 << 20) / 2) == 1);
+    r = rio_open(big,O_RDONLY,0);
+    CHECK(rio_readn(r,buf,16) == 16);
+    rio_seek(r,0,SEEK_SET);
+    CHECK(ftruncate(fd,4 << 20) == 0);
+    CHECK(pwrite(fd,"U",1,(7 << 20) / 2) == 1);
+    CHECK(rio_seek(r,(7 << 20) / 2,SEEK_SET) == (7 << 20) / 2);
+    CHECK(rio_read(r,buf,1) == 1 && buf[0] == 'U');
+    CHECK(rio_tell(r) == (7 << 20) / 2 + 1);
+    CHECK(rio_seek(r,(5 << 20) / 2,SEEK_SET) == (5 << 20) / 2);
+    CHECK(rio_read(r,buf,1) == 1 && buf[0] == 'T');
+    rio_close(r);
+
+    r = rio_open(big,O_RDONLY,0);
+    CHECK(ftruncate(fd,1000) == 0);
+    CHECK(rio_readn(r,buf,sizeof(buf)) == 1000);
+    rio_close(r);
+
+    close(fd);
+    unlink(big);
+}
+
+// Writes through the file offset only drop the pages they touch, plus a short end-of-file page they extend past
+static void test_pcache_ranged_invalidation(void)
+{
+    rio_t r = rio_open(path,O_RDWR,0);
+    CHECK(rio_enable_pcache(r,64) == 0);
+    char buf[8];
+    CHECK(rio_preadn(r,buf,1,0) == 1);
+    CHECK(rio_preadn(r,buf,1,8192) == 1);
+    CHECK(rio_preadn(r,buf,4,16382) == 2); // Short last page of the 16384 byte file
+
+    CHECK(rio_seek(r,8192,SEEK_SET) == 8192 && rio_writen(r,"W",1) == 1);
+    CHECK(r->pcache->pages[rio_pcache_slot(r->pcache,0)].page_no == 0);
+    CHECK(r->pcache->pages[rio_pcache_slot(r->pcache,2)].page_no == -1);
+    CHECK(rio_preadn(r,buf,1,8192) == 1 && buf[0] == 'W');
+
+    // Past the end: the gap reads as zeros, not as the end of the file
+    CHECK(rio_seek(r,30000,SEEK_SET) == 30000 && rio_writen(r,"E",1) == 1);
+    CHECK(r->pcache->pages[rio_pcache_slot(r->pcache,0)].page_no == 0);
+    CHECK(rio_preadn(r,buf,4,16382) == 4 && buf[2] == 0 && buf[3] == 0);
+    CHECK(rio_preadn(r,buf,1,30000) == 1 && buf[0] == 'E');
+
+    // Put the file back for the other tests
+    char orig = 0;
+    CHECK(rio_pwriten(r,&orig,1,8192) == 1);
+    CHECK(ftruncate(r->fd,16384) == 0);
+    rio_close(r);
+}
+
+// True when the file holds exactly len bytes of data
+static int file_equals(const char *name, const char *data, size_t len)
+{
+    static char got[32768];
+    int fd = open(name,O_RDONLY);
+    ssize_t n = read(fd,got,sizeof(got));
+    close(fd);
+    return n == (ssize_t)len && !memcmp(got,data,len);
+}
+
+// rio_copy through copy_file_range, splice and the sendfile fallback, with bytes already buffered on either side
+static void test_copy(void)
+{
+    static char data[16384], want[16384];
+    int fd = open(path,O_RDONLY);
+    CHECK(read(fd,data,sizeof(data)) == sizeof(data));
+    close(fd);
+
+    char out[] = "/tmp/test_rio_out_XXXXXX";
+    close(mkstemp(out));
+
+    // File to file: src has read ahead past its cursor, dst has a pending rio_writeb that must land first
+    rio_t src = rio_open(path,O_RDONLY | RIO_NOMMAP,0);
+    rio_t dst = rio_open(out,O_WRONLY | O_TRUNC,0);
+    char buf[100];
+    CHECK(rio_read(src,buf,100) == 100 && src->unread_bytes > 0);
+    CHECK(rio_writeb(dst,"hdr",3) == 3);
+    CHECK(rio_copy(dst,src,1 << 20) == sizeof(data) - 100);
+    CHECK(rio_tell(src) == sizeof(data));
+    rio_close(dst);
+    rio_close(src);
+    memcpy(want,"hdr",3);
+    memcpy(want + 3,data + 100,sizeof(data) - 100);
+    CHECK(file_equals(out,want,sizeof(data) - 100 + 3));
+
+    // Mapped source from the middle of the mapping
+    src = rio_open(path,O_RDONLY | RIO_MMAP,0);
+    dst = rio_open(out,O_WRONLY | O_TRUNC,0);
+    CHECK(src->mmapped);
+    CHECK(rio_read(src,buf,10) == 10);
+    CHECK(rio_copy(dst,src,1000) == 1000);
+    CHECK(rio_tell(src) == 1010);
+    rio_close(dst);
+    CHECK(file_equals(out,data + 10,1000));
+
+    // O_APPEND rules out copy_file_range, the copy falls back to sendfile
+    dst = rio_open(out,O_WRONLY | O_APPEND,0);
+    CHECK(rio_copy(dst,src,500) == 500);
+    CHECK(rio_tell(src) == 1510);
+    rio_close(dst);
+    rio_close(src);
+    CHECK(file_equals(out,data + 10,1500));
+
+    // Pipe to file goes through splice and stops at EOF
+    int p[2];
+    CHECK(pipe(p) == 0);
+    CHECK(write(p[1],data,3000) == 3000);
+    close(p[1]);
+    char pipe_path[32];
+    snprintf(pipe_path,sizeof(pipe_path),"/dev/fd/%d",p[0]);
+    src = rio_open(pipe_path,O_RDONLY,0);
+    close(p[0]);
+    dst = rio_open(out,O_WRONLY | O_TRUNC,0);
+    CHECK(rio_copy(dst,src,1 << 20) == 3000);
+    rio_close(dst);
+    rio_close(src);
+    CHECK(file_equals(out,data,3000));
+
+    unlink(out);
+}
+
+// rio_writeb coalesces records across buffer boundaries, and every other path writes the pending bytes first
+static void test_writeb_flush(void)
+{
+    static char want[20000];
+    size_t len = 0;
+    char out[] = "/tmp/test_rio_out_XXXXXX";
+    close(mkstemp(out));
+    rio_t r = rio_open(out,O_RDWR | O_TRUNC | RIO_NOMMAP,0);
+
+    // 1000 byte records straddle the 4096 byte buffer, nothing reaches the file until it fills
+    char rec[1000];
+    for (int i = 0; i < 10; i++)
+    {
+        memset(rec,'a' + i,sizeof(rec));
+        CHECK(rio_writeb(r,rec,sizeof(rec)) == sizeof(rec));
+        CHECK(r->wbuf_len <= BUFFER_SIZE);
+        memcpy(want + len,rec,sizeof(rec));
+        len += sizeof(rec);
+    }
+    CHECK(r->wbuf_len == 2000); // Flushed before the 5th and 9th records, the last two wait
+    CHECK(file_equals(out,want,8000));
+    CHECK(rio_tell(r) == (off_t)len);
+
+    // A write larger than the buffer goes straight to the file after the pending bytes
+    static char big[5000];
+    memset(big,'B',sizeof(big));
+    CHECK(rio_writeb(r,big,sizeof(big)) == sizeof(big) && r->wbuf_len == 0);
+    memcpy(want + len,big,sizeof(big));
+    len += sizeof(big);
+
+    // Unbuffered writes land after earlier buffered ones
+    CHECK(rio_writeb(r,"ab",2) == 2 && rio_writen(r,"cd",2) == 2);
+    memcpy(want + len,"abcd",4);
+    len += 4;
+    CHECK(file_equals(out,want,len));
+
+    // rio_seek writes pending bytes where they were made, then moves
+    CHECK(rio_writeb(r,"xyz",3) == 3);
+    CHECK(rio_seek(r,0,SEEK_SET) == 0);
+    memcpy(want + len,"xyz",3);
+    len += 3;
+    CHECK(file_equals(out,want,len));
+
+    // rio_close writes the rest
+    CHECK(rio_writeb(r,"Q",1) == 1);
+    want[0] = 'Q';
+    rio_close(r);
+    CHECK(file_equals(out,want,len));
+    unlink(out);
+}
+
+// rio_peek compacts the unread tail and refills behind it, rio_consume never moves past what is buffered
+static void test_peek_consume(void)
+{
+    static char data[16384];
+    int fd = open(path,O_RDONLY);
+    CHECK(read(fd,data,sizeof(data)) == sizeof(data));
+    close(fd);
+
+    rio_t r = rio_open(path,O_RDONLY | RIO_NOMMAP,0);
+    static char buf[4000];
+    CHECK(rio_read(r,buf,sizeof(buf)) == sizeof(buf));
+    CHECK(r->unread_bytes == BUFFER_SIZE - 4000);
+
+    // More than the 96 byte tail: the tail moves to the front and the refill lands behind it
+    const char *p;
+    size_t avail;
+    CHECK(rio_peek(r,1000,&p,&avail) == 0 && avail >= 1000);
+    CHECK(p == r->rbuf && !memcmp(p,data + 4000,avail));
+    CHECK(rio_consume(r,1000) == 0);
+    CHECK(rio_tell(r) == 5000);
+    CHECK(rio_read(r,buf,1) == 1 && buf[0] == data[5000]);
+
+    // Consuming past the buffered bytes fails and leaves the position alone
+    CHECK(rio_peek(r,1,&p,&avail) == 0);
+    errno = 0;
+    CHECK(rio_consume(r,avail + 1) == -1 && errno == EINVAL);
+    CHECK(rio_tell(r) == 5001);
+    CHECK(rio_peek(r,BUFFER_SIZE + 1,&p,&avail) == -1 && errno == EINVAL);
+
+    // At EOF fewer than min bytes come back, then none
+    CHECK(rio_seek(r,sizeof(data) - 4,SEEK_SET) == (off_t)sizeof(data) - 4);
+    CHECK(rio_peek(r,100,&p,&avail) == 0 && avail == 4 && !memcmp(p,data + sizeof(data) - 4,4));
+    CHECK(rio_consume(r,4) == 0);
+    CHECK(rio_peek(r,1,&p,&avail) == 0 && avail == 0);
+    rio_close(r);
+}
+
+// Lines that end on, or just past, a refill boundary, one longer than maxlen, and a last line without a newline
+static void test_readline(void)
+{
+    static char text[20000];
+    size_t len = 0;
+    memset(text + len,'a',4095); len += 4095; text[len++] = '\n'; // Newline is the last byte of the first fill
+    memset(text + len,'b',4096); len += 4096; text[len++] = '\n'; // Newline is the first byte of the third fill
+    memset(text + len,'c',10000); len += 10000; text[len++] = '\n';
+    memcpy(text + len,"x;y;tail",8); len += 8;
+
+    char name[] = "/tmp/test_rio_lines_XXXXXX";
+    int fd = mkstemp(name);
+    CHECK(write(fd,text,len) == (ssize_t)len);
+    close(fd);
+
+    for (int mapped = 0; mapped < 2; mapped++)
+    {
+        rio_t r = rio_open(name,O_RDONLY | (mapped ? RIO_MMAP : RIO_NOMMAP),0);
+        static char line[8192];
+        size_t off = 0;
+        CHECK(rio_readlineb(r,line,sizeof(line)) == 4096 && !memcmp(line,text,4096));
+        off += 4096;
+        CHECK(rio_readlineb(r,line,sizeof(line)) == 4097 && !memcmp(line,text + off,4097) && line[4097] == '\0');
+        off += 4097;
+
+        // 10001 bytes through a 4097 byte buffer: two full pieces, then the rest with its newline
+        CHECK(rio_readlineb(r,line,4097) == 4096 && line[4095] == 'c' && line[4096] == '\0');
+        CHECK(rio_readlineb(r,line,4097) == 4096);
+        CHECK(rio_readlineb(r,line,4097) == 10001 - 8192 && line[10000 - 8192] == '\n');
+        off += 10001;
+
+        CHECK(rio_read_until(r,line,sizeof(line),';') == 2 && !strcmp(line,"x;"));
+        CHECK(rio_read_until(r,line,sizeof(line),';') == 2 && !strcmp(line,"y;"));
+        CHECK(rio_readlineb(r,line,sizeof(line)) == 4 && !strcmp(line,"tail"));
+        CHECK(rio_readlineb(r,line,sizeof(line)) == 0 && line[0] == '\0');
+        CHECK(rio_tell(r) == (off_t)len);
+        rio_close(r);
+    }
+    unlink(name);
+}
+
+static int pipe_w;
+
+// Feeds the pipe a few bytes at a time so every readv comes back short
+static void *trickle_writer(void *arg)
+{
+    const char *data = arg;
+    struct timespec nap = {0, 200000};
+    for (int i = 0; i < 100; i += 7)
+    {
+        if (write(pipe_w,data + i,(100 - i < 7) ? 100 - i : 7) < 0)
+        {
+            break;
+        }
+        nanosleep(&nap,NULL);
+    }
+    close(pipe_w);
+    return NULL;
+}
+
+// rio_readv/rio_writev: more iovecs than one call takes, buffered bytes on either side, short transfers
+static void test_readv_writev(void)
+{
+    static char data[16384], got[16384];
+    int fd = open(path,O_RDONLY);
+    CHECK(read(fd,data,sizeof(data)) == sizeof(data));
+    close(fd);
+
+    // Read ahead bytes drain into the first iovecs, the rest comes from readv
+    rio_t r = rio_open(path,O_RDONLY | RIO_NOMMAP,0);
+    char head[10];
+    CHECK(rio_read(r,head,sizeof(head)) == sizeof(head) && r->unread_bytes > 0);
+    struct iovec two[2] = {{got, 100}, {got + 100, 8000}};
+    CHECK(rio_readv(r,two,2) == 8100);
+    CHECK(!memcmp(got,data + 10,8100));
+    CHECK(rio_tell(r) == 8110);
+    rio_close(r);
+
+    // 1500 iovecs of 1 to 10 bytes, more than a single readv/writev accepts
+    enum { N = 1500 };
+    static struct iovec iov[N];
+    size_t total = 0;
+    for (int i = 0; i < N; i++)
+    {
+        iov[i] = (struct iovec){data + total, (size_t)(i % 10) + 1};
+        total += iov[i].iov_len;
+    }
+
+    char out[] = "/tmp/test_rio_out_XXXXXX";
+    close(mkstemp(out));
+    r = rio_open(out,O_RDWR | O_TRUNC | RIO_NOMMAP,0);
+    CHECK(rio_writeb(r,"hdr",3) == 3); // Pending buffered bytes go out before the iovecs
+    CHECK(rio_writev(r,iov,N) == (ssize_t)total);
+    CHECK(rio_seek(r,0,SEEK_SET) == 0);
+    CHECK(rio_read(r,head,3) == 3 && !memcmp(head,"hdr",3));
+    memset(got,0,sizeof(got));
+    size_t off = 0;
+    for (int i = 0; i < N; i++)
+    {
+        iov[i].iov_base = got + off;
+        off += iov[i].iov_len;
+    }
+    CHECK(rio_readv(r,iov,N) == (ssize_t)total);
+    CHECK(!memcmp(got,data,total));
+    rio_close(r);
+    unlink(out);
+
+    // Short reads from a pipe resume inside the iovec they stopped in
+    int p[2];
+    CHECK(pipe(p) == 0);
+    pipe_w = p[1];
+    char pipe_path[32];
+    snprintf(pipe_path,sizeof(pipe_path),"/dev/fd/%d",p[0]);
+    r = rio_open(pipe_path,O_RDONLY,0);
+    close(p[0]);
+    pthread_t writer;
+    pthread_create(&writer,NULL,trickle_writer,data);
+    memset(got,0,sizeof(got));
+    struct iovec parts[4] = {{got, 3}, {got + 3, 40}, {got + 43, 50}, {got + 93, 100}};
+    CHECK(rio_readv(r,parts,4) == 100);
+    CHECK(!memcmp(got,data,100));
+    pthread_join(writer,NULL);
+    rio_close(r);
+}
+
+int main(void)
+{
+    make_file(16384);
+    test_read_seek();
+    test_seek_after_write();
+    test_seek_after_readn();
+    test_mmap_resize();
+    test_pcache_ranged_invalidation();
+    test_copy();
+    test_readv_writev();
+    test_writeb_flush();
+    test_peek_consume();
+    test_readline();
+    unlink(path);
+    return check_done("test_rio");
+}